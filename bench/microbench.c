@@ -0,0 +1,302 @@
+/**
+ * @file microbench.c
+ * @brief Component microbenchmarks for the queue, the validator and packet allocation.
+ *
+ * Built with `make microbench` against the same objects as the proxy. Every
+ * result is printed as one JSON object per line so runs from different commits
+ * can be collected and compared:
+ *
+ *   {"bench":"queue_mpmc","threads":4,"ops":2000000,"ns_per_op":95.1,"ops_per_sec":10515247,"revision":"abc1234"}
+ *
+ * Usage: bin/microbench [filter]
+ *   filter  only run benchmarks whose name contains this string
+ *
+ * MICROBENCH_SCALE in the environment multiplies the operation counts.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "queue.h"
+#include "packet.h"
+#include "global.h"
+#include "tags.h"
+#include "config_reader.h"
+
+#ifndef MICROBENCH_REVISION
+#define MICROBENCH_REVISION "unknown"
+#endif
+
+// Symbols the proxy defines in main.c.
+Queue **queues = NULL;
+
+static const char *filter = NULL;
+static double scale = 1.0;
+static char stopSentinel;
+
+static double now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static long scaled(long ops) {
+    long result = (long)(ops * scale);
+    return result > 0 ? result : 1;
+}
+
+static int selected(const char *name) {
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static void report(const char *bench, int threads, long ops, double elapsedNs) {
+    printf("{\"bench\":\"%s\",\"threads\":%d,\"ops\":%ld,\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f,\"revision\":\"%s\"}\n",
+           bench, threads, ops, elapsedNs / ops, ops / (elapsedNs / 1e9), MICROBENCH_REVISION);
+    fflush(stdout);
+}
+
+/* Queue: T producers and T consumers sharing one queue. */
+
+typedef struct {
+    Queue *queue;
+    long items;
+    int batch;
+} QueueBenchArgs;
+
+static void *queue_producer(void *arg) {
+    QueueBenchArgs *args = arg;
+    for (long i = 0; i < args->items; ++i) {
+        while (tryEnqueue(args->queue, &stopSentinel + 1) != 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *queue_consumer(void *arg) {
+    QueueBenchArgs *args = arg;
+    void *items[64];
+    while (1) {
+        if (args->batch > 1) {
+            int count = dequeueBatch(args->queue, items, args->batch);
+            for (int i = 0; i < count; ++i) {
+                if (items[i] == &stopSentinel) {
+                    // Hand any other sentinels in this batch back to their consumers.
+                    for (int j = i + 1; j < count; ++j) {
+                        if (items[j] == &stopSentinel) {
+                            while (tryEnqueue(args->queue, &stopSentinel) != 0) {
+                                sched_yield();
+                            }
+                        }
+                    }
+                    return NULL;
+                }
+            }
+        } else if (dequeue(args->queue) == &stopSentinel) {
+            return NULL;
+        }
+    }
+}
+
+static void bench_queue(const char *name, int batch) {
+    if (!selected(name)) {
+        return;
+    }
+    static const int threadCounts[] = { 1, 2, 4, 8, 16, 32 };
+    for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t) {
+        int threads = threadCounts[t];
+        long total = scaled(1000000);
+        Queue *queue = initQueue(65536);
+        QueueBenchArgs args = { queue, total / threads, batch };
+        pthread_t producers[threads];
+        pthread_t consumers[threads];
+
+        double start = now_ns();
+        for (int i = 0; i < threads; ++i) {
+            pthread_create(&consumers[i], NULL, queue_consumer, &args);
+            pthread_create(&producers[i], NULL, queue_producer, &args);
+        }
+        for (int i = 0; i < threads; ++i) {
+            pthread_join(producers[i], NULL);
+        }
+        for (int i = 0; i < threads; ++i) {
+            while (tryEnqueue(queue, &stopSentinel) != 0) {
+                sched_yield();
+            }
+        }
+        for (int i = 0; i < threads; ++i) {
+            pthread_join(consumers[i], NULL);
+        }
+        report(name, threads, args.items * threads, now_ns() - start);
+    }
+}
+
+/* Validator: a corpus shaped like production traffic. */
+
+static const char *corpus[] = {
+    "api.requests.count:1|c",
+    "api.requests.latency:23.5|ms|@0.1",
+    "api.db.pool.active:17|g",
+    "frontend.page.render_time:120|ms",
+    "worker.jobs.processed:1|c|@0.5",
+    "payments.checkout.success:1|c|#env:prod,region:us-east-1,service:checkout",
+    "payments.checkout.latency:87|ms|#service:checkout,env:prod,host:web-12,env:prod",
+    "cache.hits:42|c|#cache:redis,shard:3",
+    "queue.depth:1532|g|#queue:emails",
+    "users.unique:user_1234|s",
+    "invalid metric with spaces:1|c",
+    "api.requests.count:1|c|#bad tag",
+};
+#define CORPUS_SIZE (int)(sizeof(corpus) / sizeof(corpus[0]))
+
+static void bench_validator(void) {
+    volatile int valid = 0;
+    if (selected("is_metric_valid")) {
+        long ops = scaled(2000000);
+        double start = now_ns();
+        for (long i = 0; i < ops; ++i) {
+            valid += isMetricValid(corpus[i % CORPUS_SIZE]);
+        }
+        report("is_metric_valid", 1, ops, now_ns() - start);
+    }
+
+    if (selected("normalize_metric_tags")) {
+        // Includes copying the line into a receive sized buffer, as ingress does.
+        char buffer[4097];
+        int lengths[CORPUS_SIZE];
+        for (int i = 0; i < CORPUS_SIZE; ++i) {
+            lengths[i] = (int)strlen(corpus[i]);
+        }
+        long ops = scaled(2000000);
+        double start = now_ns();
+        for (long i = 0; i < ops; ++i) {
+            int index = (int)(i % CORPUS_SIZE);
+            memcpy(buffer, corpus[index], lengths[index] + 1);
+            valid += normalizeMetricTags(buffer, lengths[index], sizeof(buffer));
+        }
+        report("normalize_metric_tags", 1, ops, now_ns() - start);
+    }
+
+    if (selected("inject_metric")) {
+        // Timed in chunks, the requeue is emptied between chunks outside the clock.
+        int chunk = 10000;
+        long chunks = (scaled(1000000) + chunk - 1) / chunk;
+        double elapsed = 0;
+        for (long c = 0; c < chunks; ++c) {
+            double start = now_ns();
+            for (int i = 0; i < chunk; ++i) {
+                injectMetric("Worker-1.PacketsSent", i);
+            }
+            elapsed += now_ns() - start;
+            for (int i = 0; i < chunk; ++i) {
+                packet_release(dequeue(requeue));
+            }
+        }
+        report("inject_metric", 1, chunks * chunk, elapsed);
+    }
+}
+
+/* Allocation: per packet malloc patterns, full receive buffers versus right-sized copies. */
+
+static void bench_alloc_size(const char *name, int size, int depth) {
+    if (!selected(name)) {
+        return;
+    }
+    long rounds = (scaled(2000000) + depth - 1) / depth;
+    Packet **held = malloc(sizeof(Packet *) * depth);
+    double start = now_ns();
+    for (long r = 0; r < rounds; ++r) {
+        // Allocate a queue's worth, then release in FIFO order like the workers do.
+        for (int i = 0; i < depth; ++i) {
+            held[i] = packet_alloc(size);
+            held[i]->data[0] = 'a';
+        }
+        for (int i = 0; i < depth; ++i) {
+            packet_release(held[i]);
+        }
+    }
+    report(name, 1, rounds * depth, now_ns() - start);
+    free(held);
+}
+
+// The ingress pattern: accepted lines copied into right-sized packets and queued.
+static void bench_copy_queued(const char *name, int depth) {
+    if (!selected(name)) {
+        return;
+    }
+    int lengths[CORPUS_SIZE];
+    for (int i = 0; i < CORPUS_SIZE; ++i) {
+        lengths[i] = (int)strlen(corpus[i]);
+    }
+    long rounds = (scaled(2000000) + depth - 1) / depth;
+    Packet **held = malloc(sizeof(Packet *) * depth);
+    double start = now_ns();
+    for (long r = 0; r < rounds; ++r) {
+        for (int i = 0; i < depth; ++i) {
+            held[i] = packet_copy(corpus[i % CORPUS_SIZE], lengths[i % CORPUS_SIZE]);
+        }
+        for (int i = 0; i < depth; ++i) {
+            packet_release(held[i]);
+        }
+    }
+    report(name, 1, rounds * depth, now_ns() - start);
+    free(held);
+}
+
+static void *alloc_thread(void *arg) {
+    long ops = *(long *)arg;
+    for (long i = 0; i < ops; ++i) {
+        Packet *packet = packet_alloc(4097);
+        packet->data[0] = 'a';
+        packet_release(packet);
+    }
+    return NULL;
+}
+
+static void bench_alloc(void) {
+    bench_alloc_size("alloc_4097_single", 4097, 1);
+    bench_alloc_size("alloc_64_single", 64, 1);
+    bench_alloc_size("alloc_4097_queued", 4097, 10000);
+    bench_alloc_size("alloc_64_queued", 64, 10000);
+    bench_copy_queued("copy_corpus_queued", 10000);
+
+    if (selected("alloc_4097_threads")) {
+        static const int threadCounts[] = { 1, 4, 16, 32 };
+        for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t) {
+            int threads = threadCounts[t];
+            long perThread = scaled(2000000) / threads;
+            pthread_t workers[threads];
+            double start = now_ns();
+            for (int i = 0; i < threads; ++i) {
+                pthread_create(&workers[i], NULL, alloc_thread, &perThread);
+            }
+            for (int i = 0; i < threads; ++i) {
+                pthread_join(workers[i], NULL);
+            }
+            report("alloc_4097_threads", threads, perThread * threads, now_ns() - start);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        filter = argv[1];
+    }
+    const char *scaleEnv = getenv("MICROBENCH_SCALE");
+    if (scaleEnv != NULL && atof(scaleEnv) > 0) {
+        scale = atof(scaleEnv);
+    }
+
+    requeue = initQueue(1 << 20);
+    strcpy(config.TAGS_INJECT, "dc:east");
+    strcpy(config.TAGS_STRIP, "host");
+    tags_init();
+
+    bench_queue("queue_mpmc", 1);
+    bench_queue("queue_mpmc_batch", 64);
+    bench_validator();
+    bench_alloc();
+    return 0;
+}
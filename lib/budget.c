@@ -0,0 +1,113 @@
+/**
+ * @file budget.c
+ * @brief Global byte budget for packets in flight, with admission control.
+ *
+ * Every packet buffer and every queue node in use is charged here when it is
+ * taken and credited when it is freed, so the count covers the receive
+ * batches, the worker and fanout queues, the requeue and sends in progress.
+ *
+ * With MEMORY_BUDGET_MB set, ingress admits a datagram only while usage is
+ * below the threshold of its priority class: low priority is refused from
+ * MEMORY_SHED_PERCENT of the budget, normal from halfway between that and the
+ * budget, high at the budget itself. The proxy's own metrics are not subject
+ * to admission, they are few and bounded by the requeue.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "budget.h"
+#include "priority.h"
+#include "config_reader.h"
+#include "global.h"
+#include "logger.h"
+
+static long usedBytes = 0;
+static long peakBytes = 0;
+static long budgetBytes = 0;
+static long limits[QUEUE_LANES];
+static unsigned long rejected[QUEUE_LANES];
+static unsigned long reportedRejected[QUEUE_LANES];
+static const char *classNames[QUEUE_LANES] = { "high", "normal", "low" };
+
+/**
+ * Reads MEMORY_BUDGET_MB and MEMORY_SHED_PERCENT and sets the class thresholds.
+ */
+void budget_init(void) {
+    if (config.MEMORY_BUDGET_MB <= 0) {
+        return;
+    }
+    budgetBytes = (long)config.MEMORY_BUDGET_MB * 1024 * 1024;
+    int shedPercent = config.MEMORY_SHED_PERCENT > 0 && config.MEMORY_SHED_PERCENT <= 100 ? config.MEMORY_SHED_PERCENT : 80;
+    limits[PRIORITY_HIGH] = budgetBytes;
+    limits[PRIORITY_LOW] = budgetBytes / 100 * shedPercent;
+    limits[PRIORITY_NORMAL] = (limits[PRIORITY_LOW] + budgetBytes) / 2;
+    write_log("Memory budget %d MB, shedding low priority from %d%%", config.MEMORY_BUDGET_MB, shedPercent);
+}
+
+void budget_charge(long bytes) {
+    long used = __atomic_add_fetch(&usedBytes, bytes, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&peakBytes, __ATOMIC_RELAXED);
+    while (used > peak && !__atomic_compare_exchange_n(&peakBytes, &peak, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void budget_credit(long bytes) {
+    __atomic_sub_fetch(&usedBytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @return Bytes of packets and queue nodes currently allocated.
+ */
+long budget_used(void) {
+    return __atomic_load_n(&usedBytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Decides whether a received datagram of the given class may be queued.
+ *
+ * @return false if memory is above the class threshold, the caller drops the datagram.
+ */
+bool budget_admit(int priority) {
+    if (budgetBytes == 0 || budget_used() < limits[priority]) {
+        return true;
+    }
+    __atomic_add_fetch(&rejected[priority], 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+/**
+ * Injects memory usage and the datagrams refused since the last call, called by the supervisor.
+ */
+void budget_inject_metrics(void) {
+    injectMetric("memory.used_kb", (int)(budget_used() / 1024));
+    for (int lane = 0; lane < QUEUE_LANES; ++lane) {
+        unsigned long total = __atomic_load_n(&rejected[lane], __ATOMIC_RELAXED);
+        if (total > reportedRejected[lane]) {
+            char metric_name[64];
+            snprintf(metric_name, sizeof(metric_name), "memory.rejected.%s", classNames[lane]);
+            injectMetric(metric_name, (int)(total - reportedRejected[lane]));
+            reportedRejected[lane] = total;
+        }
+    }
+}
+
+/**
+ * Writes the budget, current and peak usage and refusals per class as plain text.
+ *
+ * @return Number of bytes written to out.
+ */
+int budget_report(char *out, size_t outSize) {
+    long used = budget_used();
+    int written = snprintf(out, outSize, "budget_bytes %ld\nused_bytes %ld\npeak_bytes %ld\nlive_packets %ld\n",
+                           budgetBytes, used, __atomic_load_n(&peakBytes, __ATOMIC_RELAXED), packet_live_count());
+    if (budgetBytes > 0 && written < (int)outSize) {
+        written += snprintf(out + written, outSize - written, "used_percent %.1f\n", 100.0 * used / budgetBytes);
+    }
+    if (written < (int)outSize) {
+        written += snprintf(out + written, outSize - written, "class admit_below_bytes rejected\n");
+    }
+    for (int lane = 0; lane < QUEUE_LANES && written < (int)outSize; ++lane) {
+        written += snprintf(out + written, outSize - written, "%s %ld %lu\n",
+                            classNames[lane], limits[lane], __atomic_load_n(&rejected[lane], __ATOMIC_RELAXED));
+    }
+    return written < (int)outSize ? written : (int)outSize - 1;
+}
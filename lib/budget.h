@@ -0,0 +1,15 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void budget_init(void);
+void budget_charge(long bytes);
+void budget_credit(long bytes);
+long budget_used(void);
+bool budget_admit(int priority);
+void budget_inject_metrics(void);
+int budget_report(char *out, size_t outSize);
+
+#endif // BUDGET_H
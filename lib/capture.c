@@ -0,0 +1,162 @@
+/**
+ * @file capture.c
+ * @brief Records validated ingress datagrams to a memory-mapped capture file.
+ *
+ * The file at CAPTURE_PATH is sized to CAPTURE_MAX_MB up front and mapped, so
+ * recording a datagram is a memcpy under a mutex, with no syscall. One in
+ * CAPTURE_SAMPLE datagrams is kept, each with the time since the previous
+ * record. When the file is full capturing stops, the proxy keeps running.
+ * On shutdown the file is truncated to what was written.
+ *
+ * Replay the file with bin/CStatsDReplay, see tools/replay.c.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "capture.h"
+#include "config_reader.h"
+#include "logger.h"
+
+static int captureFd = -1;
+static char *captureMap = NULL;
+static CaptureHeader *header = NULL;
+static uint64_t captureCapacity = 0;
+static uint32_t sampleEvery = 1;
+static unsigned long seen = 0;
+static unsigned long skippedFull = 0;
+static uint64_t lastRecordNs = 0;
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * Creates the capture file, replacing any previous one at CAPTURE_PATH, and maps it.
+ *
+ * @return 0 on success, -1 if the file could not be created or mapped.
+ */
+int capture_init(void) {
+    int maxMb = config.CAPTURE_MAX_MB > 0 ? config.CAPTURE_MAX_MB : 256;
+    captureCapacity = (uint64_t)maxMb * 1024 * 1024;
+    sampleEvery = config.CAPTURE_SAMPLE > 0 ? config.CAPTURE_SAMPLE : 1;
+
+    captureFd = open(config.CAPTURE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0640);
+    if (captureFd < 0) {
+        write_log("Could not open capture file %s", config.CAPTURE_PATH);
+        return -1;
+    }
+    if (ftruncate(captureFd, captureCapacity) < 0) {
+        write_log("Could not size capture file %s to %d MB", config.CAPTURE_PATH, maxMb);
+        close(captureFd);
+        return -1;
+    }
+    captureMap = mmap(NULL, captureCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, captureFd, 0);
+    if (captureMap == MAP_FAILED) {
+        write_log("Could not map capture file %s", config.CAPTURE_PATH);
+        captureMap = NULL;
+        close(captureFd);
+        return -1;
+    }
+
+    CaptureHeader *newHeader = (CaptureHeader *)captureMap;
+    memcpy(newHeader->magic, CAPTURE_MAGIC, sizeof(newHeader->magic));
+    newHeader->version = CAPTURE_VERSION;
+    newHeader->headerSize = sizeof(CaptureHeader);
+    newHeader->capacity = captureCapacity;
+    newHeader->startTime = time(NULL);
+    newHeader->sampleEvery = sampleEvery;
+    lastRecordNs = monotonic_ns();
+    __atomic_store_n(&header, newHeader, __ATOMIC_RELEASE);
+
+    write_log("Capturing 1 in %u datagrams to %s, up to %d MB", sampleEvery, config.CAPTURE_PATH, maxMb);
+    return 0;
+}
+
+/**
+ * Appends a datagram to the capture file if it is sampled and fits.
+ */
+void capture_record(const char *data, int len) {
+    CaptureHeader *capture = __atomic_load_n(&header, __ATOMIC_ACQUIRE);
+    if (capture == NULL) {
+        return;
+    }
+    if (__atomic_fetch_add(&seen, 1, __ATOMIC_RELAXED) % sampleEvery != 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&capture_mutex);
+    if (header == NULL) {
+        pthread_mutex_unlock(&capture_mutex);
+        return;
+    }
+    uint64_t offset = capture->headerSize + capture->used;
+    if (offset + sizeof(CaptureRecord) + len > captureCapacity) {
+        if (skippedFull++ == 0) {
+            write_log("Capture file %s is full, no longer capturing", config.CAPTURE_PATH);
+        }
+        pthread_mutex_unlock(&capture_mutex);
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    uint64_t deltaMicros = (now - lastRecordNs) / 1000;
+    lastRecordNs = now;
+    CaptureRecord record = { deltaMicros > UINT32_MAX ? UINT32_MAX : (uint32_t)deltaMicros, (uint32_t)len };
+    memcpy(captureMap + offset, &record, sizeof(record));
+    memcpy(captureMap + offset + sizeof(record), data, len);
+    capture->records++;
+    __atomic_store_n(&capture->used, capture->used + sizeof(record) + len, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+/**
+ * Stops capturing and trims the file to the records written.
+ */
+void capture_close(void) {
+    pthread_mutex_lock(&capture_mutex);
+    CaptureHeader *capture = header;
+    if (capture == NULL) {
+        pthread_mutex_unlock(&capture_mutex);
+        return;
+    }
+    __atomic_store_n(&header, NULL, __ATOMIC_RELEASE);
+    uint64_t fileSize = capture->headerSize + capture->used;
+    unsigned long records = capture->records;
+    capture->capacity = fileSize;
+    pthread_mutex_unlock(&capture_mutex);
+
+    munmap(captureMap, captureCapacity);
+    if (ftruncate(captureFd, fileSize) < 0) {
+        write_log("Could not trim capture file %s", config.CAPTURE_PATH);
+    }
+    close(captureFd);
+    write_log("Capture closed: %lu datagrams, %llu bytes in %s", records, (unsigned long long)fileSize, config.CAPTURE_PATH);
+}
+
+/**
+ * Writes the capture state as plain text.
+ *
+ * @return Number of bytes written to out.
+ */
+int capture_report(char *out, size_t outSize) {
+    pthread_mutex_lock(&capture_mutex);
+    if (header == NULL) {
+        pthread_mutex_unlock(&capture_mutex);
+        return snprintf(out, outSize, "capture disabled\n");
+    }
+    int written = snprintf(out, outSize, "path %s\nsample_every %u\nseen %lu\nrecords %llu\nbytes_used %llu\nbytes_capacity %llu\nskipped_full %lu\n",
+                           config.CAPTURE_PATH, sampleEvery, __atomic_load_n(&seen, __ATOMIC_RELAXED),
+                           (unsigned long long)header->records,
+                           (unsigned long long)(header->headerSize + header->used),
+                           (unsigned long long)captureCapacity, skippedFull);
+    pthread_mutex_unlock(&capture_mutex);
+    return written < (int)outSize ? written : (int)outSize - 1;
+}
@@ -0,0 +1,40 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "CSDCAP1"
+#define CAPTURE_VERSION 1
+
+/**
+ * Capture file layout, shared with the replay tool.
+ *
+ * A CaptureHeader, then records packed back to back with no padding: a
+ * CaptureRecord followed by len bytes of the datagram. `used` counts the
+ * record bytes after the header and is only advanced once a record is
+ * complete, so a reader never sees half a record even while capturing.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t capacity;
+    uint64_t used;
+    uint64_t records;
+    int64_t startTime;
+    uint32_t sampleEvery;
+    uint32_t reserved;
+} CaptureHeader;
+
+typedef struct {
+    uint32_t deltaMicros;  // Since the previous record, saturates at UINT32_MAX
+    uint32_t len;
+} CaptureRecord;
+
+int capture_init(void);
+void capture_record(const char *data, int len);
+void capture_close(void);
+int capture_report(char *out, size_t outSize);
+
+#endif // CAPTURE_H
@@ -0,0 +1,390 @@
+/**
+ * @file cardinality.c
+ * @brief Per-prefix cardinality limiter.
+ *
+ * Every metric name is grouped under a prefix made of its first
+ * CARDINALITY_PREFIX_DEPTH dot separated segments. Each prefix owns a
+ * HyperLogLog sketch that estimates how many unique names were seen under it
+ * during the current interval, for the report. A sketch can estimate how many
+ * names there are but not whether a given name is one of them, so admission
+ * uses a set of 32 bit fingerprints of the names each prefix admitted this
+ * interval. The first CARDINALITY_LIMIT names pass and are added to the set.
+ * After that only names found in the set pass, and any other name is dropped
+ * or collapsed into "<prefix>.cardinality_overflow". The set never holds more
+ * than CARDINALITY_LIMIT names, so at most that many pass per interval, plus
+ * the rare new name whose fingerprint matches an admitted one (about one in
+ * 500 million lookups at the limit).
+ *
+ * The slot table and the sets are allocated once at startup, so memory
+ * stays fixed no matter how many names arrive. Prefixes that do not fit in
+ * the table share slot 0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "cardinality.h"
+#include "config_reader.h"
+#include "global.h"
+#include "logger.h"
+
+#define CARDINALITY_HLL_BITS 10
+#define CARDINALITY_HLL_REGISTERS (1 << CARDINALITY_HLL_BITS)
+#define CARDINALITY_PREFIX_MAX 128
+#define CARDINALITY_MAX_PROBES 8
+#define CARDINALITY_TOP_N 10
+
+static const char overflowSuffix[] = ".cardinality_overflow";
+
+typedef struct {
+    uint64_t prefixHash;
+    int used;
+    char prefix[CARDINALITY_PREFIX_MAX];
+    uint8_t registers[CARDINALITY_HLL_REGISTERS];
+    double inverseSum;      // sum of 2^-register, kept up to date so estimates are O(1)
+    int zeroRegisters;
+    uint32_t *names;        // Fingerprints of the names admitted this interval, 0 = empty
+    int admitted;
+    unsigned long passed;
+    unsigned long dropped;
+    unsigned long collapsed;
+} CardinalitySlot;
+
+typedef struct {
+    char prefix[CARDINALITY_PREFIX_MAX];
+    double estimate;
+    unsigned long passed;
+    unsigned long dropped;
+    unsigned long collapsed;
+} CardinalityOffender;
+
+static CardinalitySlot *slots = NULL;
+static uint32_t *nameSets = NULL;
+static uint32_t nameMask = 0;
+static int slotCount = 0;
+static int prefixDepth = 2;
+static int nameLimit = 10000;
+static int intervalSeconds = 60;
+static int overLimitAction = CARDINALITY_ACTION_DROP;
+static time_t intervalStart = 0;
+static CardinalityOffender lastTop[CARDINALITY_TOP_N];
+static int lastTopCount = 0;
+static pthread_mutex_t cardinality_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a followed by the murmur3 finalizer, HyperLogLog needs well mixed high bits.
+static uint64_t hash_bytes(const char *data, int len) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (int i = 0; i < len; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static void reset_slot(CardinalitySlot *slot) {
+    slot->prefixHash = 0;
+    slot->used = 0;
+    slot->prefix[0] = '\0';
+    memset(slot->registers, 0, sizeof(slot->registers));
+    slot->inverseSum = CARDINALITY_HLL_REGISTERS;
+    slot->zeroRegisters = CARDINALITY_HLL_REGISTERS;
+    if (slot->admitted > 0) {
+        memset(slot->names, 0, sizeof(uint32_t) * (nameMask + 1));
+    }
+    slot->admitted = 0;
+    slot->passed = 0;
+    slot->dropped = 0;
+    slot->collapsed = 0;
+}
+
+static double estimate_slot(const CardinalitySlot *slot) {
+    const double m = CARDINALITY_HLL_REGISTERS;
+    double alpha = 0.7213 / (1.0 + 1.079 / m);
+    double estimate = alpha * m * m / slot->inverseSum;
+    if (estimate <= 2.5 * m && slot->zeroRegisters > 0) {
+        estimate = m * log(m / slot->zeroRegisters);  // Linear counting for small sets
+    }
+    return estimate;
+}
+
+// Linear probing on the high half of the name hash, the low half is the fingerprint.
+// Returns 1 if the name is in the set, after adding it when insert is set.
+static int name_set_find(CardinalitySlot *slot, uint64_t nameHash, int insert) {
+    uint32_t fingerprint = (uint32_t)nameHash != 0 ? (uint32_t)nameHash : 1;
+    uint32_t position = (uint32_t)(nameHash >> 32) & nameMask;
+    while (slot->names[position] != 0) {
+        if (slot->names[position] == fingerprint) {
+            return 1;
+        }
+        position = (position + 1) & nameMask;
+    }
+    if (!insert) {
+        return 0;
+    }
+    slot->names[position] = fingerprint;
+    slot->admitted++;
+    return 1;
+}
+
+static void set_slot_prefix(CardinalitySlot *slot, uint64_t prefixHash, const char *prefix, int prefixLen) {
+    int copyLen = prefixLen < CARDINALITY_PREFIX_MAX - 1 ? prefixLen : CARDINALITY_PREFIX_MAX - 1;
+    slot->used = 1;
+    slot->prefixHash = prefixHash;
+    memcpy(slot->prefix, prefix, copyLen);
+    slot->prefix[copyLen] = '\0';
+}
+
+static CardinalitySlot *find_slot(const char *prefix, int prefixLen) {
+    uint64_t prefixHash = hash_bytes(prefix, prefixLen);
+    int index = 1 + (int)(prefixHash % (uint64_t)(slotCount - 1));
+
+    for (int probe = 0; probe < CARDINALITY_MAX_PROBES; ++probe) {
+        CardinalitySlot *slot = &slots[index];
+        if (!slot->used) {
+            set_slot_prefix(slot, prefixHash, prefix, prefixLen);
+            return slot;
+        }
+        if (slot->prefixHash == prefixHash) {
+            return slot;
+        }
+        index = index + 1 < slotCount ? index + 1 : 1;
+    }
+    return &slots[0];
+}
+
+static int compare_offenders(const void *a, const void *b) {
+    const CardinalityOffender *left = a;
+    const CardinalityOffender *right = b;
+    unsigned long leftRejected = left->dropped + left->collapsed;
+    unsigned long rightRejected = right->dropped + right->collapsed;
+    if (leftRejected != rightRejected) {
+        return leftRejected < rightRejected ? 1 : -1;
+    }
+    if (left->estimate != right->estimate) {
+        return left->estimate < right->estimate ? 1 : -1;
+    }
+    return 0;
+}
+
+// Collects the worst CARDINALITY_TOP_N prefixes of the current interval, caller holds the mutex.
+static int collect_top(CardinalityOffender *top) {
+    int count = 0;
+    for (int i = 0; i < slotCount; ++i) {
+        CardinalitySlot *slot = &slots[i];
+        if (!slot->used) {
+            continue;
+        }
+        CardinalityOffender candidate;
+        strcpy(candidate.prefix, slot->prefix);
+        candidate.estimate = estimate_slot(slot);
+        candidate.passed = slot->passed;
+        candidate.dropped = slot->dropped;
+        candidate.collapsed = slot->collapsed;
+
+        if (count < CARDINALITY_TOP_N) {
+            top[count++] = candidate;
+            qsort(top, count, sizeof(CardinalityOffender), compare_offenders);
+        } else if (compare_offenders(&candidate, &top[count - 1]) < 0) {
+            top[count - 1] = candidate;
+            qsort(top, count, sizeof(CardinalityOffender), compare_offenders);
+        }
+    }
+    return count;
+}
+
+// Closes the interval when it has expired, caller holds the mutex.
+static void maybe_rollover(time_t now) {
+    if (difftime(now, intervalStart) < intervalSeconds) {
+        return;
+    }
+
+    unsigned long totalDropped = 0;
+    unsigned long totalCollapsed = 0;
+    int prefixesOverLimit = 0;
+    for (int i = 0; i < slotCount; ++i) {
+        if (!slots[i].used) {
+            continue;
+        }
+        totalDropped += slots[i].dropped;
+        totalCollapsed += slots[i].collapsed;
+        if (slots[i].dropped > 0 || slots[i].collapsed > 0) {
+            prefixesOverLimit++;
+        }
+    }
+
+    lastTopCount = collect_top(lastTop);
+    if (totalDropped > 0) {
+        injectMetric("cardinality.dropped", (int)totalDropped);
+    }
+    if (totalCollapsed > 0) {
+        injectMetric("cardinality.collapsed", (int)totalCollapsed);
+    }
+    if (prefixesOverLimit > 0) {
+        injectMetric("cardinality.prefixes_over_limit", prefixesOverLimit);
+        if (config.LOGGING_ENABLED) {
+            write_log("Cardinality limit hit by %d prefixes, top offender %s", prefixesOverLimit, lastTop[0].prefix);
+        }
+    }
+
+    for (int i = 0; i < slotCount; ++i) {
+        reset_slot(&slots[i]);
+    }
+    set_slot_prefix(&slots[0], 0, "(overflow)", 10);
+    intervalStart = now;
+}
+
+/**
+ * Allocates the fixed size slot table from the CARDINALITY_* settings.
+ *
+ * @return 0 on success, -1 if the table could not be allocated.
+ */
+int cardinality_init(void) {
+    slotCount = config.CARDINALITY_SLOTS > 1 ? config.CARDINALITY_SLOTS : 1024;
+    prefixDepth = config.CARDINALITY_PREFIX_DEPTH > 0 ? config.CARDINALITY_PREFIX_DEPTH : 2;
+    nameLimit = config.CARDINALITY_LIMIT > 0 ? config.CARDINALITY_LIMIT : 10000;
+    intervalSeconds = config.CARDINALITY_INTERVAL > 0 ? config.CARDINALITY_INTERVAL : 60;
+    overLimitAction = config.CARDINALITY_ACTION;
+
+    // A power of two at most three quarters full when the limit is reached.
+    uint32_t setSize = 1;
+    while (setSize < (uint32_t)nameLimit / 3 * 4 + 4) {
+        setSize <<= 1;
+    }
+    nameMask = setSize - 1;
+    slots = malloc(sizeof(CardinalitySlot) * slotCount);
+    nameSets = calloc((size_t)setSize * slotCount, sizeof(uint32_t));
+    if (slots == NULL || nameSets == NULL) {
+        write_log("Failed to allocate cardinality table");
+        return -1;
+    }
+    for (int i = 0; i < slotCount; ++i) {
+        slots[i].names = nameSets + (size_t)setSize * i;
+        slots[i].admitted = 0;
+        reset_slot(&slots[i]);
+    }
+    set_slot_prefix(&slots[0], 0, "(overflow)", 10);
+    intervalStart = time(NULL);
+
+    write_log("Cardinality limiter enabled: %d names per prefix of depth %d, %d slots (%zu bytes)",
+              nameLimit, prefixDepth, slotCount, (sizeof(CardinalitySlot) + sizeof(uint32_t) * setSize) * slotCount);
+    return 0;
+}
+
+/**
+ * Checks a validated metric line against the budget of its prefix.
+ *
+ * @param metric   The metric line, null terminated. Rewritten in place when collapsed.
+ * @param len      Length of the line, updated when the line is collapsed.
+ * @param capacity Size of the buffer holding the line.
+ * @return CARDINALITY_PASS, CARDINALITY_DROP or CARDINALITY_COLLAPSED.
+ */
+int cardinality_check(char *metric, int *len, int capacity) {
+    if (slots == NULL) {
+        return CARDINALITY_PASS;
+    }
+
+    const char *colon = memchr(metric, ':', *len);
+    int nameLen = colon != NULL ? (int)(colon - metric) : *len;
+
+    // The prefix is the first prefixDepth segments, or the parent of a shorter name.
+    int prefixLen = nameLen;
+    int lastDot = -1;
+    int dots = 0;
+    for (int i = 0; i < nameLen; ++i) {
+        if (metric[i] == '.') {
+            lastDot = i;
+            if (++dots == prefixDepth) {
+                break;
+            }
+        }
+    }
+    if (lastDot > 0) {
+        prefixLen = lastDot;
+    }
+
+    uint64_t nameHash = hash_bytes(metric, nameLen);
+    int registerIndex = (int)(nameHash >> (64 - CARDINALITY_HLL_BITS));
+    uint64_t remaining = nameHash << CARDINALITY_HLL_BITS;
+    uint8_t rank = remaining == 0 ? 64 - CARDINALITY_HLL_BITS + 1 : (uint8_t)(__builtin_clzll(remaining) + 1);
+
+    pthread_mutex_lock(&cardinality_mutex);
+    maybe_rollover(time(NULL));
+
+    CardinalitySlot *slot = find_slot(metric, prefixLen);
+    uint8_t current = slot->registers[registerIndex];
+    if (rank > current) {
+        slot->inverseSum += ldexp(1.0, -rank) - ldexp(1.0, -current);
+        if (current == 0) {
+            slot->zeroRegisters--;
+        }
+        slot->registers[registerIndex] = rank;
+    }
+
+    // Names already admitted this interval pass, new ones only while under the limit.
+    if (name_set_find(slot, nameHash, slot->admitted < nameLimit)) {
+        slot->passed++;
+        pthread_mutex_unlock(&cardinality_mutex);
+        return CARDINALITY_PASS;
+    }
+
+    int collapsedLen = prefixLen + (int)sizeof(overflowSuffix) - 1 + (*len - nameLen);
+    if (overLimitAction != CARDINALITY_ACTION_COLLAPSE || collapsedLen >= capacity) {
+        slot->dropped++;
+        pthread_mutex_unlock(&cardinality_mutex);
+        return CARDINALITY_DROP;
+    }
+    slot->collapsed++;
+    pthread_mutex_unlock(&cardinality_mutex);
+
+    memmove(metric + prefixLen + sizeof(overflowSuffix) - 1, metric + nameLen, *len - nameLen);
+    memcpy(metric + prefixLen, overflowSuffix, sizeof(overflowSuffix) - 1);
+    metric[collapsedLen] = '\0';
+    *len = collapsedLen;
+    return CARDINALITY_COLLAPSED;
+}
+
+static int append_offenders(char *out, size_t outSize, int written, const char *title,
+                            const CardinalityOffender *top, int count) {
+    written += snprintf(out + written, outSize - written, "%s\nprefix estimate passed dropped collapsed\n", title);
+    for (int i = 0; i < count && written < (int)outSize; ++i) {
+        written += snprintf(out + written, outSize - written, "%s %.0f %lu %lu %lu\n",
+                            top[i].prefix, top[i].estimate, top[i].passed, top[i].dropped, top[i].collapsed);
+    }
+    return written;
+}
+
+/**
+ * Writes the top offending prefixes of the current and previous interval as plain text.
+ *
+ * @return Number of bytes written to out.
+ */
+int cardinality_report(char *out, size_t outSize) {
+    if (slots == NULL) {
+        return snprintf(out, outSize, "cardinality limiter disabled\n");
+    }
+
+    CardinalityOffender currentTop[CARDINALITY_TOP_N];
+    pthread_mutex_lock(&cardinality_mutex);
+    maybe_rollover(time(NULL));
+    int currentCount = collect_top(currentTop);
+    int written = snprintf(out, outSize, "limit %d\nprefix_depth %d\ninterval %d\naction %s\n",
+                           nameLimit, prefixDepth, intervalSeconds,
+                           overLimitAction == CARDINALITY_ACTION_COLLAPSE ? "collapse" : "drop");
+    if (written < (int)outSize) {
+        written = append_offenders(out, outSize, written, "current_interval", currentTop, currentCount);
+    }
+    if (written < (int)outSize) {
+        written = append_offenders(out, outSize, written, "previous_interval", lastTop, lastTopCount);
+    }
+    pthread_mutex_unlock(&cardinality_mutex);
+
+    return written < (int)outSize ? written : (int)outSize - 1;
+}
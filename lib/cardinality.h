@@ -0,0 +1,17 @@
+#ifndef CARDINALITY_H
+#define CARDINALITY_H
+
+#include <stddef.h>
+
+#define CARDINALITY_PASS 0
+#define CARDINALITY_DROP 1
+#define CARDINALITY_COLLAPSED 2
+
+#define CARDINALITY_ACTION_DROP 0
+#define CARDINALITY_ACTION_COLLAPSE 1
+
+int cardinality_init(void);
+int cardinality_check(char *metric, int *len, int capacity);
+int cardinality_report(char *out, size_t outSize);
+
+#endif // CARDINALITY_H
@@ -110,6 +110,88 @@ int read_config(const char *filepath) {
             config.HTTP_LISTEN_IP[sizeof(config.HTTP_LISTEN_IP) - 1] = '\0'; // Ensure null-termination
         } else if (case_insensitive_compare(key, "OUTBOUND_UDP_TIMEOUT")) {
             config.OUTBOUND_UDP_TIMEOUT = atoi(value);
+        } else if (case_insensitive_compare(key, "CARDINALITY_ENABLED")) {
+            config.CARDINALITY_ENABLED = atoi(value);
+        } else if (case_insensitive_compare(key, "CARDINALITY_PREFIX_DEPTH")) {
+            config.CARDINALITY_PREFIX_DEPTH = atoi(value);
+        } else if (case_insensitive_compare(key, "CARDINALITY_LIMIT")) {
+            config.CARDINALITY_LIMIT = atoi(value);
+        } else if (case_insensitive_compare(key, "CARDINALITY_INTERVAL")) {
+            config.CARDINALITY_INTERVAL = atoi(value);
+        } else if (case_insensitive_compare(key, "CARDINALITY_ACTION")) {
+            config.CARDINALITY_ACTION = atoi(value);
+        } else if (case_insensitive_compare(key, "CARDINALITY_SLOTS")) {
+            config.CARDINALITY_SLOTS = atoi(value);
+        } else if (case_insensitive_compare(key, "TAGS_INJECT")) {
+            strncpy(config.TAGS_INJECT, value, sizeof(config.TAGS_INJECT) - 1);
+            config.TAGS_INJECT[sizeof(config.TAGS_INJECT) - 1] = '\0'; // Ensure null-termination
+        } else if (case_insensitive_compare(key, "TAGS_STRIP")) {
+            strncpy(config.TAGS_STRIP, value, sizeof(config.TAGS_STRIP) - 1);
+            config.TAGS_STRIP[sizeof(config.TAGS_STRIP) - 1] = '\0'; // Ensure null-termination
+        } else if (case_insensitive_compare(key, "FANOUT_DESTINATIONS")) {
+            strncpy(config.FANOUT_DESTINATIONS, value, sizeof(config.FANOUT_DESTINATIONS) - 1);
+            config.FANOUT_DESTINATIONS[sizeof(config.FANOUT_DESTINATIONS) - 1] = '\0'; // Ensure null-termination
+        } else if (case_insensitive_compare(key, "FANOUT_QUEUE_SIZE")) {
+            config.FANOUT_QUEUE_SIZE = atoi(value);
+        } else if (case_insensitive_compare(key, "FANOUT_BATCH_SIZE")) {
+            config.FANOUT_BATCH_SIZE = atoi(value);
+        } else if (case_insensitive_compare(key, "DRAIN_TIMEOUT")) {
+            config.DRAIN_TIMEOUT = atoi(value);
+        } else if (case_insensitive_compare(key, "UNIX_SOCKET_ENABLED")) {
+            config.UNIX_SOCKET_ENABLED = atoi(value);
+        } else if (case_insensitive_compare(key, "UNIX_SOCKET_PATH")) {
+            strncpy(config.UNIX_SOCKET_PATH, value, sizeof(config.UNIX_SOCKET_PATH) - 1);
+            config.UNIX_SOCKET_PATH[sizeof(config.UNIX_SOCKET_PATH) - 1] = '\0'; // Ensure null-termination
+        } else if (case_insensitive_compare(key, "UNIX_SOCKET_MODE")) {
+            char *modeEnd;
+            long mode = strtol(value, &modeEnd, 8);  // Octal, like chmod
+            config.UNIX_SOCKET_MODE = modeEnd != value && *modeEnd == '\0' ? (int)mode : 0;  // 0 falls back to 0660
+        } else if (case_insensitive_compare(key, "UNIX_SOCKET_RCVBUF")) {
+            config.UNIX_SOCKET_RCVBUF = atoi(value);
+        } else if (case_insensitive_compare(key, "SOURCE_TRACKING_ENABLED")) {
+            config.SOURCE_TRACKING_ENABLED = atoi(value);
+        } else if (case_insensitive_compare(key, "SOURCE_TOPK_SIZE")) {
+            config.SOURCE_TOPK_SIZE = atoi(value);
+        } else if (case_insensitive_compare(key, "SOURCE_TOPK_INTERVAL")) {
+            config.SOURCE_TOPK_INTERVAL = atoi(value);
+        } else if (case_insensitive_compare(key, "SOURCE_RATE_LIMIT")) {
+            config.SOURCE_RATE_LIMIT = atoi(value);
+        } else if (case_insensitive_compare(key, "SOURCE_RATE_BURST")) {
+            config.SOURCE_RATE_BURST = atoi(value);
+        } else if (case_insensitive_compare(key, "LISTEN_RCVBUF")) {
+            config.LISTEN_RCVBUF = atoi(value);
+        } else if (case_insensitive_compare(key, "OUTBOUND_SNDBUF")) {
+            config.OUTBOUND_SNDBUF = atoi(value);
+        } else if (case_insensitive_compare(key, "RECV_BATCH_SIZE")) {
+            config.RECV_BATCH_SIZE = atoi(value);
+        } else if (case_insensitive_compare(key, "SOCKET_STATS_INTERVAL")) {
+            config.SOCKET_STATS_INTERVAL = atoi(value);
+        } else if (case_insensitive_compare(key, "WORKER_STALL_TIMEOUT")) {
+            config.WORKER_STALL_TIMEOUT = atoi(value);
+        } else if (case_insensitive_compare(key, "CAPTURE_ENABLED")) {
+            config.CAPTURE_ENABLED = atoi(value);
+        } else if (case_insensitive_compare(key, "CAPTURE_PATH")) {
+            strncpy(config.CAPTURE_PATH, value, sizeof(config.CAPTURE_PATH) - 1);
+            config.CAPTURE_PATH[sizeof(config.CAPTURE_PATH) - 1] = '\0'; // Ensure null-termination
+        } else if (case_insensitive_compare(key, "CAPTURE_MAX_MB")) {
+            config.CAPTURE_MAX_MB = atoi(value);
+        } else if (case_insensitive_compare(key, "CAPTURE_SAMPLE")) {
+            config.CAPTURE_SAMPLE = atoi(value);
+        } else if (case_insensitive_compare(key, "PRIORITY_HIGH_PREFIXES")) {
+            strncpy(config.PRIORITY_HIGH_PREFIXES, value, sizeof(config.PRIORITY_HIGH_PREFIXES) - 1);
+            config.PRIORITY_HIGH_PREFIXES[sizeof(config.PRIORITY_HIGH_PREFIXES) - 1] = '\0'; // Ensure null-termination
+        } else if (case_insensitive_compare(key, "PRIORITY_LOW_PREFIXES")) {
+            strncpy(config.PRIORITY_LOW_PREFIXES, value, sizeof(config.PRIORITY_LOW_PREFIXES) - 1);
+            config.PRIORITY_LOW_PREFIXES[sizeof(config.PRIORITY_LOW_PREFIXES) - 1] = '\0'; // Ensure null-termination
+        } else if (case_insensitive_compare(key, "PRIORITY_MODE")) {
+            config.PRIORITY_MODE = atoi(value);
+        } else if (case_insensitive_compare(key, "PRIORITY_WEIGHTS")) {
+            strncpy(config.PRIORITY_WEIGHTS, value, sizeof(config.PRIORITY_WEIGHTS) - 1);
+            config.PRIORITY_WEIGHTS[sizeof(config.PRIORITY_WEIGHTS) - 1] = '\0'; // Ensure null-termination
+        } else if (case_insensitive_compare(key, "MEMORY_BUDGET_MB")) {
+            config.MEMORY_BUDGET_MB = atoi(value);
+        } else if (case_insensitive_compare(key, "MEMORY_SHED_PERCENT")) {
+            config.MEMORY_SHED_PERCENT = atoi(value);
         }
     }
 
@@ -19,6 +19,42 @@ typedef struct {
     int HTTP_PORT;
     char HTTP_LISTEN_IP[50];
     int OUTBOUND_UDP_TIMEOUT;
+    int CARDINALITY_ENABLED;
+    int CARDINALITY_PREFIX_DEPTH;
+    int CARDINALITY_LIMIT;
+    int CARDINALITY_INTERVAL;
+    int CARDINALITY_ACTION;
+    int CARDINALITY_SLOTS;
+    char TAGS_INJECT[200];
+    char TAGS_STRIP[200];
+    char FANOUT_DESTINATIONS[200];
+    int FANOUT_QUEUE_SIZE;
+    int FANOUT_BATCH_SIZE;
+    int DRAIN_TIMEOUT;
+    int UNIX_SOCKET_ENABLED;
+    char UNIX_SOCKET_PATH[108];
+    int UNIX_SOCKET_MODE;
+    int UNIX_SOCKET_RCVBUF;
+    int SOURCE_TRACKING_ENABLED;
+    int SOURCE_TOPK_SIZE;
+    int SOURCE_TOPK_INTERVAL;
+    int SOURCE_RATE_LIMIT;
+    int SOURCE_RATE_BURST;
+    int LISTEN_RCVBUF;
+    int OUTBOUND_SNDBUF;
+    int RECV_BATCH_SIZE;
+    int SOCKET_STATS_INTERVAL;
+    int WORKER_STALL_TIMEOUT;
+    int CAPTURE_ENABLED;
+    char CAPTURE_PATH[200];
+    int CAPTURE_MAX_MB;
+    int CAPTURE_SAMPLE;
+    char PRIORITY_HIGH_PREFIXES[200];
+    char PRIORITY_LOW_PREFIXES[200];
+    int PRIORITY_MODE;
+    char PRIORITY_WEIGHTS[32];
+    int MEMORY_BUDGET_MB;
+    int MEMORY_SHED_PERCENT;
 } Config;
 
 extern Config config;
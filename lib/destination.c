@@ -0,0 +1,173 @@
+/**
+ * @file destination.c
+ * @brief Connected outbound sockets and per destination send health.
+ *
+ * Every worker and every fanout sender owns a UDP socket connect()ed to its
+ * destination, so the kernel resolves the route once and sends skip the
+ * address lookup. A connected socket also receives the ICMP errors for its
+ * destination, which are counted per destination and served at /destinations.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "destination.h"
+#include "config_reader.h"
+#include "sockstats.h"
+#include "global.h"
+#include "logger.h"
+
+static DestinationHealth destinations[DESTINATION_MAX];
+static int destinationCount = 0;
+static pthread_mutex_t destination_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns the health record for ip:port, creating it on first use.
+ */
+DestinationHealth *destination_register(const char *ip, int port) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s:%d", ip, port);
+
+    pthread_mutex_lock(&destination_mutex);
+    for (int i = 0; i < destinationCount; ++i) {
+        if (strcmp(destinations[i].name, name) == 0) {
+            pthread_mutex_unlock(&destination_mutex);
+            return &destinations[i];
+        }
+    }
+    DestinationHealth *health = NULL;
+    if (destinationCount < DESTINATION_MAX) {
+        health = &destinations[destinationCount++];
+        memset(health, 0, sizeof(*health));
+        strcpy(health->name, name);
+    }
+    pthread_mutex_unlock(&destination_mutex);
+    return health;
+}
+
+/**
+ * Creates a UDP socket connected to ip:port with the outbound buffer and timeout applied.
+ *
+ * @param address Filled with the destination address.
+ * @return The socket, or -1 on failure.
+ */
+int destination_connect_udp(const char *ip, int port, struct sockaddr_in *address) {
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &address->sin_addr) <= 0) {
+        write_log("Invalid destination address: %s", ip);
+        return -1;
+    }
+
+    int udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udpSocket == -1) {
+        write_log("Outbound socket creation failed for %s:%d", ip, port);
+        return -1;
+    }
+    if (connect(udpSocket, (struct sockaddr *)address, sizeof(*address)) < 0) {
+        write_log("Connect failed for %s:%d", ip, port);
+        close(udpSocket);
+        return -1;
+    }
+
+    socket_set_buffer(udpSocket, 0, config.OUTBOUND_SNDBUF, "Outbound socket");
+    struct timeval timeout;
+    timeout.tv_sec = config.OUTBOUND_UDP_TIMEOUT;
+    timeout.tv_usec = 0;
+    if (setsockopt(udpSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+        write_log("setsockopt failed");
+    }
+    return udpSocket;
+}
+
+void destination_record_sent(DestinationHealth *health, int count) {
+    if (health != NULL) {
+        __atomic_add_fetch(&health->sent, count, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Counts a failed send by cause. ECONNREFUSED and the unreachable errors are
+ * ICMP replies to earlier datagrams, EAGAIN means OUTBOUND_UDP_TIMEOUT expired.
+ */
+void destination_record_error(DestinationHealth *health, int err) {
+    if (health == NULL) {
+        return;
+    }
+    switch (err) {
+        case ECONNREFUSED:
+            __atomic_add_fetch(&health->refused, 1, __ATOMIC_RELAXED);
+            break;
+        case EHOSTUNREACH:
+        case ENETUNREACH:
+        case EHOSTDOWN:
+            __atomic_add_fetch(&health->unreachable, 1, __ATOMIC_RELAXED);
+            break;
+        case EAGAIN:
+            __atomic_add_fetch(&health->timeouts, 1, __ATOMIC_RELAXED);
+            break;
+        default:
+            __atomic_add_fetch(&health->otherErrors, 1, __ATOMIC_RELAXED);
+            break;
+    }
+    health->lastErrno = err;
+    health->lastErrorTime = time(NULL);
+}
+
+static unsigned long total_errors(const DestinationHealth *health) {
+    return __atomic_load_n(&health->refused, __ATOMIC_RELAXED) +
+           __atomic_load_n(&health->unreachable, __ATOMIC_RELAXED) +
+           __atomic_load_n(&health->timeouts, __ATOMIC_RELAXED) +
+           __atomic_load_n(&health->otherErrors, __ATOMIC_RELAXED);
+}
+
+/**
+ * Injects the send errors of each destination since the last call.
+ */
+void destination_inject_metrics(void) {
+    for (int i = 0; i < destinationCount; ++i) {
+        unsigned long errors = total_errors(&destinations[i]);
+        if (errors > destinations[i].reportedErrors) {
+            // Dots and colons split StatsD names, keep the address in one segment.
+            char address[64];
+            strcpy(address, destinations[i].name);
+            for (char *c = address; *c != '\0'; ++c) {
+                if (*c == '.' || *c == ':') {
+                    *c = '_';
+                }
+            }
+            char metric_name[128];
+            snprintf(metric_name, sizeof(metric_name), "destination.%s.send_errors", address);
+            injectMetric(metric_name, (int)(errors - destinations[i].reportedErrors));
+            destinations[i].reportedErrors = errors;
+        }
+    }
+}
+
+/**
+ * Writes one line per destination with its send and error counters.
+ *
+ * @return Number of bytes written to out.
+ */
+int destination_report(char *out, size_t outSize) {
+    time_t now = time(NULL);
+    int written = snprintf(out, outSize, "destination sent refused unreachable timeouts other last_errno last_error_age\n");
+    for (int i = 0; i < destinationCount && written < (int)outSize; ++i) {
+        DestinationHealth *health = &destinations[i];
+        long age = health->lastErrorTime != 0 ? (long)difftime(now, health->lastErrorTime) : -1;
+        written += snprintf(out + written, outSize - written, "%s %lu %lu %lu %lu %lu %d %ld\n",
+                            health->name,
+                            __atomic_load_n(&health->sent, __ATOMIC_RELAXED),
+                            __atomic_load_n(&health->refused, __ATOMIC_RELAXED),
+                            __atomic_load_n(&health->unreachable, __ATOMIC_RELAXED),
+                            __atomic_load_n(&health->timeouts, __ATOMIC_RELAXED),
+                            __atomic_load_n(&health->otherErrors, __ATOMIC_RELAXED),
+                            health->lastErrno, age);
+    }
+    return written < (int)outSize ? written : (int)outSize - 1;
+}
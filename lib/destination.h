@@ -0,0 +1,34 @@
+#ifndef DESTINATION_H
+#define DESTINATION_H
+
+#include <stddef.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#define DESTINATION_MAX 16
+
+/**
+ * Send health of one outbound destination. Sockets are connected, so ICMP
+ * port/host unreachable replies come back as errors on a later send and are
+ * counted here.
+ */
+typedef struct {
+    char name[64];
+    unsigned long sent;
+    unsigned long refused;
+    unsigned long unreachable;
+    unsigned long timeouts;
+    unsigned long otherErrors;
+    unsigned long reportedErrors;
+    time_t lastErrorTime;
+    int lastErrno;
+} DestinationHealth;
+
+DestinationHealth *destination_register(const char *ip, int port);
+int destination_connect_udp(const char *ip, int port, struct sockaddr_in *address);
+void destination_record_sent(DestinationHealth *health, int count);
+void destination_record_error(DestinationHealth *health, int err);
+void destination_inject_metrics(void);
+int destination_report(char *out, size_t outSize);
+
+#endif // DESTINATION_H
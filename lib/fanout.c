@@ -0,0 +1,214 @@
+/**
+ * @file fanout.c
+ * @brief Mirrors every accepted packet to additional destinations.
+ *
+ * Each destination listed in FANOUT_DESTINATIONS (plus the legacy
+ * CLONE_DEST_UDP_IP when CLONE_ENABLED is set) gets its own socket, queue and
+ * sender thread. Publishing a packet only takes a reference to it, the bytes
+ * are shared with the primary workers. Senders drain their queue in batches
+ * with sendmmsg, and a full queue drops for that destination alone, lowest
+ * priority class first, so a slow mirror never holds up the primary path.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "fanout.h"
+#include "queue.h"
+#include "global.h"
+#include "logger.h"
+#include "config_reader.h"
+#include "destination.h"
+#include <errno.h>
+
+typedef struct {
+    char ip[50];
+    int port;
+    struct sockaddr_in addr;
+    int udpSocket;
+    Queue *queue;
+    DestinationHealth *health;
+    pthread_t thread;
+    int index;
+    unsigned long sent;
+    unsigned long dropped;
+    unsigned long errors;
+} FanoutTarget;
+
+static FanoutTarget targets[FANOUT_MAX_TARGETS];
+static int targetCount = 0;
+static int batchSize = 64;
+
+static int add_target(const char *ip, int port) {
+    if (targetCount == FANOUT_MAX_TARGETS) {
+        write_log("Too many fanout destinations, ignoring %s:%d", ip, port);
+        return -1;
+    }
+    FanoutTarget *target = &targets[targetCount];
+    memset(target, 0, sizeof(*target));
+    strncpy(target->ip, ip, sizeof(target->ip) - 1);
+    target->port = port;
+    if (port <= 0) {
+        write_log("Invalid fanout destination: %s:%d", ip, port);
+        return -1;
+    }
+    target->udpSocket = destination_connect_udp(ip, port, &target->addr);
+    if (target->udpSocket == -1) {
+        write_log("Invalid fanout destination: %s:%d", ip, port);
+        return -1;
+    }
+    target->health = destination_register(ip, port);
+
+    target->queue = initQueue(config.FANOUT_QUEUE_SIZE > 0 ? config.FANOUT_QUEUE_SIZE : 100000);
+    target->index = targetCount;
+    targetCount++;
+    return 0;
+}
+
+static void *fanout_thread(void *arg) {
+    FanoutTarget *target = (FanoutTarget *)arg;
+    char thread_name[16];
+    snprintf(thread_name, sizeof(thread_name), "Fanout_%d", target->index);
+    set_thread_name(thread_name);
+
+    Packet *batch[batchSize];
+    struct mmsghdr messages[batchSize];
+    struct iovec iovecs[batchSize];
+    memset(messages, 0, sizeof(messages));
+    for (int i = 0; i < batchSize; ++i) {
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (1) {
+        int count = dequeueBatch(target->queue, (void **)batch, batchSize);
+        for (int i = 0; i < count; ++i) {
+            iovecs[i].iov_base = batch[i]->data;
+            iovecs[i].iov_len = batch[i]->len;
+        }
+
+        // The socket is connected, so no address per message. A failed call
+        // often reports a pending ICMP error left by an earlier datagram, the
+        // message at that position was fine, so it is retried once and only
+        // skipped when the retry fails too.
+        int done = 0;
+        int sent = 0;
+        int retried = -1;
+        while (done < count) {
+            int result = sendmmsg(target->udpSocket, messages + done, count - done, 0);
+            if (result > 0) {
+                done += result;
+                sent += result;
+                continue;
+            }
+            int err = errno;
+            destination_record_error(target->health, err);
+            if (err == EAGAIN) {
+                // Timed out, mirrors are best effort so the rest of this batch is lost.
+                __atomic_add_fetch(&target->errors, count - done, __ATOMIC_RELAXED);
+                break;
+            }
+            if (retried != done) {
+                retried = done;
+                continue;
+            }
+            __atomic_add_fetch(&target->errors, 1, __ATOMIC_RELAXED);
+            done++;
+        }
+        __atomic_add_fetch(&target->sent, sent, __ATOMIC_RELAXED);
+        destination_record_sent(target->health, sent);
+
+        for (int i = 0; i < count; ++i) {
+            packet_release(batch[i]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Creates the fanout destinations from CLONE_* and FANOUT_DESTINATIONS and starts their senders.
+ *
+ * @return 0 on success, -1 if a sender thread could not be started.
+ */
+int fanout_init(void) {
+    batchSize = config.FANOUT_BATCH_SIZE > 0 ? config.FANOUT_BATCH_SIZE : 64;
+    if (batchSize > FANOUT_BATCH_MAX) {
+        write_log("FANOUT_BATCH_SIZE %d is above the maximum, using %d", batchSize, FANOUT_BATCH_MAX);
+        batchSize = FANOUT_BATCH_MAX;
+    }
+
+    if (config.CLONE_ENABLED) {
+        add_target(config.CLONE_DEST_UDP_IP, config.CLONE_DEST_UDP_PORT);
+    }
+
+    char destinations[sizeof(config.FANOUT_DESTINATIONS)];
+    strncpy(destinations, config.FANOUT_DESTINATIONS, sizeof(destinations) - 1);
+    destinations[sizeof(destinations) - 1] = '\0';
+    char *saveptr;
+    for (char *token = strtok_r(destinations, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+        if (strspn(token, " \t\r\n") == strlen(token)) {
+            continue;  // An empty setting arrives as a lone newline
+        }
+        char *colon = strrchr(token, ':');
+        if (colon == NULL) {
+            write_log("Invalid fanout destination, expected ip:port: %s", token);
+            continue;
+        }
+        *colon = '\0';
+        add_target(token, atoi(colon + 1));
+    }
+
+    for (int i = 0; i < targetCount; ++i) {
+        if (pthread_create(&targets[i].thread, NULL, fanout_thread, &targets[i]) != 0) {
+            write_log("Could not create fanout thread for %s:%d", targets[i].ip, targets[i].port);
+            return -1;
+        }
+        write_log("Fanout to %s:%d", targets[i].ip, targets[i].port);
+    }
+    return 0;
+}
+
+/**
+ * Hands the packet to every fanout destination. Each queued copy holds its own
+ * reference, the caller keeps the reference it came with.
+ */
+void fanout_publish(Packet *packet) {
+    for (int i = 0; i < targetCount; ++i) {
+        void *evicted = NULL;
+        packet_retain(packet);
+        if (tryEnqueueLane(targets[i].queue, packet, packet->priority, &evicted) != 0) {
+            __atomic_add_fetch(&targets[i].dropped, 1, __ATOMIC_RELAXED);
+            packet_release(packet);
+        }
+        if (evicted != NULL) {
+            // A lower priority packet made room.
+            __atomic_add_fetch(&targets[i].dropped, 1, __ATOMIC_RELAXED);
+            packet_release(evicted);
+        }
+    }
+}
+
+/**
+ * Writes one line per destination with its queue depth and counters.
+ *
+ * @return Number of bytes written to out.
+ */
+int fanout_report(char *out, size_t outSize) {
+    int written = snprintf(out, outSize, "destination queued sent dropped errors\n");
+    for (int i = 0; i < targetCount && written < (int)outSize; ++i) {
+        pthread_mutex_lock(&targets[i].queue->mutex);
+        int queued = targets[i].queue->currentSize;
+        pthread_mutex_unlock(&targets[i].queue->mutex);
+        written += snprintf(out + written, outSize - written, "%s:%d %d %lu %lu %lu\n",
+                            targets[i].ip, targets[i].port, queued,
+                            __atomic_load_n(&targets[i].sent, __ATOMIC_RELAXED),
+                            __atomic_load_n(&targets[i].dropped, __ATOMIC_RELAXED),
+                            __atomic_load_n(&targets[i].errors, __ATOMIC_RELAXED));
+    }
+    return written < (int)outSize ? written : (int)outSize - 1;
+}
@@ -0,0 +1,14 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stddef.h>
+#include "packet.h"
+
+#define FANOUT_MAX_TARGETS 8
+#define FANOUT_BATCH_MAX 1024  // Sender arrays live on the thread stack
+
+int fanout_init(void);
+void fanout_publish(Packet *packet);
+int fanout_report(char *out, size_t outSize);
+
+#endif // FANOUT_H
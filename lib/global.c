@@ -10,6 +10,9 @@
 #include <stdio.h>
 #include "queue.h"
 #include "global.h"
+#include "tags.h"
+#include "fanout.h"
+#include "priority.h"
 #include <string.h>
 #include <stdbool.h>
 
@@ -35,27 +38,75 @@ void set_thread_name(const char *thread_name) {
 #endif
 }
 
+static volatile int metricsStopped = 0;
+
+/**
+ * Stops injectMetric for good. Called when a drain starts, so the proxy's own
+ * metrics do not add to the packets the drain is waiting for.
+ */
+void stop_metric_injection(void) {
+    metricsStopped = 1;
+}
+
 void injectMetric(const char *metricName, int metricValue) {
-    char *statsd_metric = malloc(256);
-    if (statsd_metric != NULL) {
-        snprintf(statsd_metric, 256, "CStatsDProxy.metrics.%s:%d|c", metricName, metricValue);
-        enqueue(requeue, statsd_metric);
+    if (metricsStopped) {
+        return;
+    }
+    char line[256];
+    int len = snprintf(line, sizeof(line), "CStatsDProxy.metrics.%s:%d|c", metricName, metricValue);
+    if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
+    }
+    Packet *packet = packet_copy(line, len);
+    if (packet != NULL) {
+        packet->priority = PRIORITY_HIGH;  // The proxy's own telemetry is shed last
+        fanout_publish(packet);
+        if (enqueuePacket(requeue, packet) != 0) {
+            packet_release(packet);
+        }
     }
 }
 
-void injectPacket(const char *packet) {
-        enqueue(requeue, packet);
+void injectPacket(Packet *packet) {
+    packet_retain(packet);
+    if (enqueuePacket(requeue, packet) != 0) {
+        packet_release(packet);
+    }
+}
+
+/**
+ * Queues a packet in its priority lane. When the queue is full a packet of a
+ * lower lane is shed to make room and released here.
+ *
+ * @return 0 on success, -1 if the packet was dropped. The caller still owns it on failure.
+ */
+int enqueuePacket(Queue *queue, Packet *packet) {
+    void *evicted = NULL;
+    int result = enqueueLane(queue, packet, packet->priority, &evicted);
+    if (evicted != NULL) {
+        packet_release(evicted);
+    }
+    return result;
 }
 
 bool isMetricValid(const char *metric) {
-    if (strlen(metric) >= 500) {
+    int len = (int)strlen(metric);
+    if (len >= 500) {
         return false;  // Too long
     }
 
     const char *valid_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.:|-_@";
-    
-    for (int i = 0; i < strlen(metric); ++i) {
-        if (strchr(valid_chars, metric[i]) == NULL) {
+
+    // DogStatsD tags live in a "|#" section that ends at the next '|', they are checked separately.
+    for (int i = 0; i < len; ++i) {
+        if (metric[i] == '#' && i > 0 && metric[i - 1] == '|') {
+            const char *sectionEnd = memchr(metric + i + 1, '|', len - i - 1);
+            int sectionLen = sectionEnd != NULL ? (int)(sectionEnd - (metric + i + 1)) : len - i - 1;
+            if (!isTagSectionValid(metric + i + 1, sectionLen)) {
+                return false;
+            }
+            i += sectionLen;
+        } else if (strchr(valid_chars, metric[i]) == NULL) {
             return false;  // Invalid character found
         }
     }
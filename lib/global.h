@@ -4,6 +4,7 @@
 #include "queue.h" 
 #include "logger.h"
 #include "requeue.h"
+#include "packet.h"
 #include <stdbool.h>
 
 
@@ -11,9 +12,11 @@ extern Queue *requeue;
 
 void set_thread_name(const char *thread_name);
 void injectMetric(const char *metricName, int metricValue);
+void stop_metric_injection(void);
 bool isMetricValid(const char *metric);
 bool is_safe_string(const char *str);
-void injectPacket(const char *packet);
+void injectPacket(Packet *packet);
+int enqueuePacket(Queue *queue, Packet *packet);
 
 
 #endif // THREAD_UTILS_H
@@ -10,11 +10,30 @@
 #include <arpa/inet.h>
 #include "logger.h"
 #include "config_reader.h"
+#include "cardinality.h"
+#include "fanout.h"
+#include "sources.h"
+#include "sockstats.h"
+#include "destination.h"
+#include "watchdog.h"
+#include "capture.h"
+#include "priority.h"
+#include "budget.h"
 
 #define MAX_THREADS 25
 volatile int active_threads = 0;
 pthread_mutex_t active_threads_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static void write_text_response(int sock, const char *body, int bodyLen) {
+    char header[128];
+    int headerLen = snprintf(header, sizeof(header),
+                             "HTTP/1.1 200 OK\r\n"
+                             "Content-Length: %d\r\n"
+                             "Content-Type: text/plain\r\n"
+                             "\r\n", bodyLen);
+    write(sock, header, headerLen);
+    write(sock, body, bodyLen);
+}
 
 void *handle_request(void *client_sock) {
     int sock = *((int *)client_sock);
@@ -44,6 +63,42 @@ void *handle_request(void *client_sock) {
 
     if (strstr(buffer, "/healthcheck")) {
         write(sock, response, sizeof(response) - 1);
+    } else if (strstr(buffer, "/cardinality")) {
+        char report[8192];
+        int reportLen = cardinality_report(report, sizeof(report));
+        write_text_response(sock, report, reportLen);
+    } else if (strstr(buffer, "/fanout")) {
+        char report[2048];
+        int reportLen = fanout_report(report, sizeof(report));
+        write_text_response(sock, report, reportLen);
+    } else if (strstr(buffer, "/sources")) {
+        char report[8192];
+        int reportLen = sources_report(report, sizeof(report));
+        write_text_response(sock, report, reportLen);
+    } else if (strstr(buffer, "/sockets")) {
+        char report[1024];
+        int reportLen = sockstats_report(report, sizeof(report));
+        write_text_response(sock, report, reportLen);
+    } else if (strstr(buffer, "/destinations")) {
+        char report[2048];
+        int reportLen = destination_report(report, sizeof(report));
+        write_text_response(sock, report, reportLen);
+    } else if (strstr(buffer, "/stalls")) {
+        char report[4096];
+        int reportLen = watchdog_report(report, sizeof(report));
+        write_text_response(sock, report, reportLen);
+    } else if (strstr(buffer, "/capture")) {
+        char report[1024];
+        int reportLen = capture_report(report, sizeof(report));
+        write_text_response(sock, report, reportLen);
+    } else if (strstr(buffer, "/priority")) {
+        char report[2048];
+        int reportLen = priority_report(report, sizeof(report));
+        write_text_response(sock, report, reportLen);
+    } else if (strstr(buffer, "/memory")) {
+        char report[1024];
+        int reportLen = budget_report(report, sizeof(report));
+        write_text_response(sock, report, reportLen);
     } else {
         write(sock, response404, sizeof(response404) - 1);
     }
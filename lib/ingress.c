@@ -0,0 +1,76 @@
+/**
+ * @file ingress.c
+ * @brief Common path for every received datagram, whichever listener it came from.
+ *
+ * Accounts the datagram to its sender, validates the line, captures it when enabled, normalizes its tags,
+ * applies the cardinality limiter, assigns its priority class, checks the memory budget, copies it into a
+ * right-sized packet, mirrors it to the fanout destinations and hands it to a worker queue.
+ */
+#include <stdio.h>
+#include "ingress.h"
+#include "queue.h"
+#include "global.h"
+#include "tags.h"
+#include "cardinality.h"
+#include "fanout.h"
+#include "sources.h"
+#include "watchdog.h"
+#include "capture.h"
+#include "priority.h"
+#include "budget.h"
+#include "config_reader.h"
+
+extern Queue **queues;
+
+static unsigned int roundRobinCounter = 0;
+
+/**
+ * Runs a received datagram through the ingress checks and queues it.
+ *
+ * The line is validated and rewritten in place in the caller's buffer, which
+ * is reused once this returns. An accepted line is copied into a packet of
+ * its own size, so queued packets do not hold a full receive buffer each.
+ *
+ * @param buffer   Receive buffer holding recvLen bytes.
+ * @param recvLen  Number of bytes received, less than capacity.
+ * @param capacity Size of buffer, tag injection may grow the line up to it.
+ * @param source   Sender address, NULL for listeners without one (unix socket).
+ */
+void ingress_submit(char *buffer, int recvLen, int capacity, const struct sockaddr_in *source) {
+    if (source != NULL && !sources_admit(source, recvLen)) {
+        return;
+    }
+
+    buffer[recvLen] = '\0';
+
+    int metricLen = -1;
+    if (isMetricValid(buffer)) {
+        capture_record(buffer, recvLen);  // Recorded as received, before tags are normalized
+        metricLen = normalizeMetricTags(buffer, recvLen, capacity);
+    }
+    if (metricLen < 0) {
+        injectMetric("invalid_packets", 1);
+        return;
+    }
+    if (cardinality_check(buffer, &metricLen, capacity) == CARDINALITY_DROP) {
+        return;
+    }
+
+    int priority = priority_classify(buffer, metricLen);
+    if (!budget_admit(priority)) {
+        return;
+    }
+    Packet *packet = packet_copy(buffer, metricLen);
+    if (packet == NULL) {
+        return;
+    }
+    packet->priority = priority;
+    fanout_publish(packet);
+    unsigned int worker = __atomic_fetch_add(&roundRobinCounter, 1, __ATOMIC_RELAXED) % config.MAX_THREADS;
+    for (int tries = 1; tries < config.MAX_THREADS && watchdog_is_stalled(worker); ++tries) {
+        worker = (worker + 1) % config.MAX_THREADS;  // Skip workers the watchdog took out of rotation
+    }
+    if (enqueuePacket(queues[worker], packet) != 0) {
+        packet_release(packet);
+    }
+}
@@ -0,0 +1,7 @@
+#ifndef INGRESS_H
+#define INGRESS_H
+
+#include <netinet/in.h>
+void ingress_submit(char *buffer, int recvLen, int capacity, const struct sockaddr_in *source);
+
+#endif // INGRESS_H
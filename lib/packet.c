@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <string.h>
+#include "packet.h"
+#include "queue.h"
+#include "budget.h"
+
+static long livePackets = 0;
+
+/**
+ * Allocates a packet with room for exactly capacity bytes and one reference.
+ * malloc already rounds to its own 16 byte steps, so no rounding is done here.
+ *
+ * @return The packet, or NULL if the allocation failed.
+ */
+Packet *packet_alloc(int capacity) {
+    int size = (int)sizeof(Packet) + capacity;
+    Packet *packet = malloc(size);
+    if (packet == NULL) {
+        return NULL;
+    }
+    __atomic_add_fetch(&livePackets, 1, __ATOMIC_RELAXED);
+    budget_charge(size);
+    packet->refCount = 1;
+    packet->len = 0;
+    packet->capacity = capacity;
+    packet->priority = QUEUE_DEFAULT_LANE;
+    packet->data[0] = '\0';
+    return packet;
+}
+
+/**
+ * Copies len bytes into a packet sized for them, with a terminating NUL.
+ *
+ * @return The packet, or NULL if the allocation failed.
+ */
+Packet *packet_copy(const char *data, int len) {
+    Packet *packet = packet_alloc(len + 1);
+    if (packet != NULL) {
+        memcpy(packet->data, data, len);
+        packet->data[len] = '\0';
+        packet->len = len;
+    }
+    return packet;
+}
+
+Packet *packet_from_string(const char *data) {
+    return packet_copy(data, (int)strlen(data));
+}
+
+void packet_retain(Packet *packet) {
+    __atomic_add_fetch(&packet->refCount, 1, __ATOMIC_RELAXED);
+}
+
+void packet_release(Packet *packet) {
+    if (__atomic_sub_fetch(&packet->refCount, 1, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_sub_fetch(&livePackets, 1, __ATOMIC_RELAXED);
+        budget_credit(sizeof(Packet) + packet->capacity);
+        free(packet);
+    }
+}
+
+/**
+ * Number of packets that have not been released yet, wherever they are:
+ * worker queues, fanout queues, the requeue or a sender in progress.
+ */
+long packet_live_count(void) {
+    return __atomic_load_n(&livePackets, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,29 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+/**
+ * A received datagram shared by every queue it is placed on.
+ *
+ * Datagrams are received into fixed buffers and copied into a Packet sized
+ * to the line once it is accepted. The primary worker queues and each fanout
+ * destination hold a reference to that same Packet, the bytes are not copied
+ * again. Whoever takes the last reference frees it.
+ *
+ * priority is the queue lane the packet travels in, see priority.c.
+ */
+typedef struct Packet {
+    int refCount;
+    int len;
+    int capacity;
+    int priority;
+    char data[];
+} Packet;
+
+Packet *packet_alloc(int capacity);
+Packet *packet_copy(const char *data, int len);
+Packet *packet_from_string(const char *data);
+void packet_retain(Packet *packet);
+void packet_release(Packet *packet);
+long packet_live_count(void);
+
+#endif // PACKET_H
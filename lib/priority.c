@@ -0,0 +1,184 @@
+/**
+ * @file priority.c
+ * @brief Priority classes for metrics, matched by name prefix.
+ *
+ * Every worker queue has one lane per class. A line starting with one of
+ * PRIORITY_HIGH_PREFIXES goes in the high lane, one of PRIORITY_LOW_PREFIXES
+ * in the low lane, everything else in the normal lane. The proxy's own
+ * CStatsDProxy.metrics.* lines are always high.
+ *
+ * Workers serve the lanes in strict order (PRIORITY_MODE=0) or by weighted
+ * round robin with PRIORITY_WEIGHTS (PRIORITY_MODE=1). When a queue is full
+ * the oldest packet of the lowest non-empty lane below the newcomer is shed,
+ * and the newcomer is dropped only when nothing below it is queued. Drops are
+ * counted per class.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "priority.h"
+#include "config_reader.h"
+#include "global.h"
+#include "logger.h"
+
+typedef struct {
+    const char *text;
+    int len;
+} Prefix;
+
+static const char *classNames[QUEUE_LANES] = { "high", "normal", "low" };
+
+static char highStorage[sizeof(config.PRIORITY_HIGH_PREFIXES)];
+static char lowStorage[sizeof(config.PRIORITY_LOW_PREFIXES)];
+static Prefix highPrefixes[PRIORITY_MAX_PREFIXES];
+static Prefix lowPrefixes[PRIORITY_MAX_PREFIXES];
+static int highCount = 0;
+static int lowCount = 0;
+static int weights[QUEUE_LANES] = { 8, 4, 1 };
+static int weighted = 0;
+static unsigned long reportedDrops[QUEUE_LANES];
+
+extern Queue **queues;
+
+// Splits a comma separated list from the config into storage, returns the number of prefixes kept.
+static int parse_prefixes(const char *value, char *storage, size_t storageSize, Prefix *out) {
+    int count = 0;
+    strncpy(storage, value, storageSize - 1);
+    storage[storageSize - 1] = '\0';
+
+    char *saveptr;
+    for (char *token = strtok_r(storage, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+        if (strspn(token, " \t\r\n") == strlen(token)) {
+            continue;  // An empty setting arrives as a lone newline
+        }
+        if (count == PRIORITY_MAX_PREFIXES) {
+            write_log("Too many priority prefixes, ignoring: %s", token);
+            continue;
+        }
+        out[count].text = token;
+        out[count].len = (int)strlen(token);
+        count++;
+    }
+    return count;
+}
+
+static int matches(const Prefix *prefixes, int count, const char *metric, int len) {
+    for (int i = 0; i < count; ++i) {
+        if (prefixes[i].len <= len && memcmp(metric, prefixes[i].text, prefixes[i].len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Parses the prefix lists and the service mode.
+ *
+ * @return 0 on success, -1 if PRIORITY_WEIGHTS is invalid.
+ */
+int priority_init(void) {
+    highCount = parse_prefixes(config.PRIORITY_HIGH_PREFIXES, highStorage, sizeof(highStorage), highPrefixes);
+    lowCount = parse_prefixes(config.PRIORITY_LOW_PREFIXES, lowStorage, sizeof(lowStorage), lowPrefixes);
+
+    weighted = config.PRIORITY_MODE == 1;
+    if (weighted && config.PRIORITY_WEIGHTS[0] != '\0') {
+        int parsed[QUEUE_LANES];
+        if (sscanf(config.PRIORITY_WEIGHTS, "%d,%d,%d", &parsed[0], &parsed[1], &parsed[2]) != QUEUE_LANES ||
+            parsed[0] < 1 || parsed[1] < 1 || parsed[2] < 1) {
+            write_log("Invalid PRIORITY_WEIGHTS, expected three weights of at least 1: %s", config.PRIORITY_WEIGHTS);
+            return -1;
+        }
+        memcpy(weights, parsed, sizeof(weights));
+    }
+
+    if (weighted) {
+        write_log("Priority lanes: %d high and %d low prefixes, weighted %d/%d/%d", highCount, lowCount, weights[0], weights[1], weights[2]);
+    } else {
+        write_log("Priority lanes: %d high and %d low prefixes, strict", highCount, lowCount);
+    }
+    return 0;
+}
+
+/**
+ * @return The priority class of a metric line.
+ */
+int priority_classify(const char *metric, int len) {
+    if (matches(highPrefixes, highCount, metric, len)) {
+        return PRIORITY_HIGH;
+    }
+    if (matches(lowPrefixes, lowCount, metric, len)) {
+        return PRIORITY_LOW;
+    }
+    return PRIORITY_NORMAL;
+}
+
+/**
+ * Applies the service mode to a worker queue.
+ */
+void priority_configure_queue(Queue *queue) {
+    setQueueWeights(queue, weighted ? weights : NULL);
+}
+
+// Sums queued packets and drops per class over every worker queue.
+static void collect(int *queued, unsigned long *dropped) {
+    memset(queued, 0, sizeof(int) * QUEUE_LANES);
+    memset(dropped, 0, sizeof(unsigned long) * QUEUE_LANES);
+    for (int i = 0; i < config.MAX_THREADS; ++i) {
+        pthread_mutex_lock(&queues[i]->mutex);
+        for (int lane = 0; lane < QUEUE_LANES; ++lane) {
+            queued[lane] += queues[i]->lanes[lane].size;
+            dropped[lane] += queues[i]->lanes[lane].dropped;
+        }
+        pthread_mutex_unlock(&queues[i]->mutex);
+    }
+}
+
+/**
+ * Injects the drops of each class since the last call, called by the supervisor.
+ */
+void priority_inject_metrics(void) {
+    int queued[QUEUE_LANES];
+    unsigned long dropped[QUEUE_LANES];
+    collect(queued, dropped);
+    for (int lane = 0; lane < QUEUE_LANES; ++lane) {
+        if (dropped[lane] > reportedDrops[lane]) {
+            char metric_name[64];
+            snprintf(metric_name, sizeof(metric_name), "priority.%s.dropped", classNames[lane]);
+            injectMetric(metric_name, (int)(dropped[lane] - reportedDrops[lane]));
+            reportedDrops[lane] = dropped[lane];
+        }
+    }
+}
+
+/**
+ * Writes the prefixes, mode and per class queue depth and drops as plain text.
+ *
+ * @return Number of bytes written to out.
+ */
+int priority_report(char *out, size_t outSize) {
+    int queued[QUEUE_LANES];
+    unsigned long dropped[QUEUE_LANES];
+    collect(queued, dropped);
+
+    int written = snprintf(out, outSize, "mode %s\nclass weight queued dropped prefixes\n", weighted ? "weighted" : "strict");
+    for (int lane = 0; lane < QUEUE_LANES && written < (int)outSize; ++lane) {
+        written += snprintf(out + written, outSize - written, "%s %d %d %lu ",
+                            classNames[lane], weighted ? weights[lane] : 0, queued[lane], dropped[lane]);
+        const Prefix *prefixes = lane == PRIORITY_HIGH ? highPrefixes : lowPrefixes;
+        int count = lane == PRIORITY_HIGH ? highCount : lane == PRIORITY_LOW ? lowCount : 0;
+        if (lane == PRIORITY_HIGH && written < (int)outSize) {
+            written += snprintf(out + written, outSize - written, "CStatsDProxy.metrics.");
+        }
+        for (int i = 0; i < count && written < (int)outSize; ++i) {
+            const char *separator = i > 0 || lane == PRIORITY_HIGH ? "," : "";
+            written += snprintf(out + written, outSize - written, "%s%.*s", separator, prefixes[i].len, prefixes[i].text);
+        }
+        if (lane == PRIORITY_NORMAL && written < (int)outSize) {
+            written += snprintf(out + written, outSize - written, "*");
+        }
+        if (written < (int)outSize) {
+            written += snprintf(out + written, outSize - written, "\n");
+        }
+    }
+    return written < (int)outSize ? written : (int)outSize - 1;
+}
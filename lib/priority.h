@@ -0,0 +1,20 @@
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include <stddef.h>
+#include "queue.h"
+
+// Priority classes, each is a lane of the worker queues.
+#define PRIORITY_HIGH 0
+#define PRIORITY_NORMAL QUEUE_DEFAULT_LANE
+#define PRIORITY_LOW 2
+
+#define PRIORITY_MAX_PREFIXES 32
+
+int priority_init(void);
+int priority_classify(const char *metric, int len);
+void priority_configure_queue(Queue *queue);
+void priority_inject_metrics(void);
+int priority_report(char *out, size_t outSize);
+
+#endif // PRIORITY_H
@@ -1,54 +1,242 @@
 #include "queue.h"
 #include "logger.h"
+#include "budget.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Nodes are allocated this many at a time and never handed back to malloc.
+// A queue's nodes sit in a few contiguous chunks and are reused most recently
+// freed first, instead of one malloc and free per packet.
+#define QUEUE_NODE_CHUNK 256
 
 Queue* initQueue(int maxSize) {
     Queue *queue = malloc(sizeof(Queue));
-    queue->head = NULL;
-    queue->tail = NULL;
+    memset(queue->lanes, 0, sizeof(queue->lanes));
+    memset(queue->weights, 0, sizeof(queue->weights));
     queue->maxSize = maxSize;
     queue->currentSize = 0;
+    queue->servingLane = 0;
+    queue->servingCredit = 0;
+    queue->freeNodes = NULL;
     pthread_mutex_init(&queue->mutex, NULL);
     pthread_cond_init(&queue->cond, NULL);
     return queue;
 }
 
-void enqueue(Queue *queue, void *data) {
+/**
+ * Switches the queue between strict priority (weights NULL) and weighted
+ * round robin, where lane i is served up to weights[i] items in a row while
+ * other lanes are waiting. Every weight must be at least 1.
+ */
+void setQueueWeights(Queue *queue, const int *weights) {
+    pthread_mutex_lock(&queue->mutex);
+    for (int i = 0; i < QUEUE_LANES; ++i) {
+        queue->weights[i] = weights != NULL ? weights[i] : 0;
+    }
+    queue->servingLane = 0;
+    queue->servingCredit = queue->weights[0];
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Takes a node from the queue's free list, caller holds the mutex.
+static Node *allocNodeLocked(Queue *queue) {
+    if (queue->freeNodes == NULL) {
+        Node *chunk = malloc(sizeof(Node) * QUEUE_NODE_CHUNK);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        for (int i = QUEUE_NODE_CHUNK - 1; i >= 0; --i) {
+            chunk[i].next = queue->freeNodes;
+            queue->freeNodes = &chunk[i];
+        }
+    }
+    Node *node = queue->freeNodes;
+    queue->freeNodes = node->next;
+    budget_charge(sizeof(Node));
+    return node;
+}
+
+// Returns a node to the queue's free list, caller holds the mutex.
+static void freeNodeLocked(Queue *queue, Node *node) {
+    node->next = queue->freeNodes;
+    queue->freeNodes = node;
+    budget_credit(sizeof(Node));
+}
+
+static void pushLocked(Lane *lane, Node *node) {
+    if (lane->tail == NULL) {
+        lane->head = node;
+    } else {
+        lane->tail->next = node;
+    }
+    lane->tail = node;
+    lane->size++;
+}
+
+static Node *popLocked(Lane *lane) {
+    Node *node = lane->head;
+    lane->head = node->next;
+    if (lane->head == NULL) {
+        lane->tail = NULL;
+    }
+    lane->size--;
+    return node;
+}
+
+/**
+ * Appends data to a lane without logging when it is full.
+ *
+ * When the queue is full and evicted is not NULL, the oldest item of the
+ * lowest lane below this one is removed to make room and handed back in
+ * evicted, for the caller to dispose of. Drops are counted on the lane that
+ * lost the item.
+ *
+ * @return 0 on success, -1 if the queue is full. The caller still owns data on failure.
+ */
+int tryEnqueueLane(Queue *queue, void *data, int lane, void **evicted) {
+    if (evicted != NULL) {
+        *evicted = NULL;
+    }
     pthread_mutex_lock(&queue->mutex);
     if (queue->currentSize >= queue->maxSize) {
-        write_log("Queue is full. Dropping packet. %d", queue->maxSize);
+        int victim = QUEUE_LANES - 1;
+        while (evicted != NULL && victim > lane && queue->lanes[victim].head == NULL) {
+            victim--;
+        }
+        if (evicted == NULL || victim <= lane) {
+            queue->lanes[lane].dropped++;
+            pthread_mutex_unlock(&queue->mutex);
+            return -1;
+        }
+        Node *node = popLocked(&queue->lanes[victim]);
+        queue->lanes[victim].dropped++;
+        *evicted = node->data;
+        // Reuse the node for the new item.
+        node->data = data;
+        node->next = NULL;
+        pushLocked(&queue->lanes[lane], node);
         pthread_mutex_unlock(&queue->mutex);
-        return;
+        return 0;
+    }
+    Node *node = allocNodeLocked(queue);
+    if (node == NULL) {
+        queue->lanes[lane].dropped++;
+        pthread_mutex_unlock(&queue->mutex);
+        return -1;
     }
-    Node *node = malloc(sizeof(Node));
     node->data = data;
     node->next = NULL;
-    if (queue->tail == NULL) {
-        queue->head = node;
-        queue->tail = node;
-    } else {
-        queue->tail->next = node;
-        queue->tail = node;
-    }
+    pushLocked(&queue->lanes[lane], node);
     queue->currentSize++;
     pthread_cond_signal(&queue->cond);
     pthread_mutex_unlock(&queue->mutex);
+    return 0;
+}
+
+static time_t lastFullLog = 0;
+static unsigned long fullSinceLog = 0;
+
+// Logs a full queue at most once a second across all queues, with the drops since the last line.
+static void logQueueFull(Queue *queue) {
+    __atomic_add_fetch(&fullSinceLog, 1, __ATOMIC_RELAXED);
+    time_t now = time(NULL);
+    time_t last = __atomic_load_n(&lastFullLog, __ATOMIC_RELAXED);
+    if (now != last && __atomic_compare_exchange_n(&lastFullLog, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        unsigned long dropped = __atomic_exchange_n(&fullSinceLog, 0, __ATOMIC_RELAXED);
+        write_log("Queue is full. Dropped %lu packets. %d", dropped, queue->maxSize);
+    }
+}
+
+int enqueueLane(Queue *queue, void *data, int lane, void **evicted) {
+    if (tryEnqueueLane(queue, data, lane, evicted) != 0) {
+        logQueueFull(queue);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Appends data to the default lane without logging when it is full.
+ *
+ * @return 0 on success, -1 if the queue is full. The caller still owns data on failure.
+ */
+int tryEnqueue(Queue *queue, void *data) {
+    return tryEnqueueLane(queue, data, QUEUE_DEFAULT_LANE, NULL);
+}
+
+int enqueue(Queue *queue, void *data) {
+    return enqueueLane(queue, data, QUEUE_DEFAULT_LANE, NULL);
+}
+
+// Picks the lane to serve next, caller holds the mutex and the queue is not empty.
+static int nextLaneLocked(Queue *queue) {
+    if (queue->weights[0] > 0) {
+        for (int tries = 0; tries <= QUEUE_LANES; ++tries) {
+            if (queue->servingCredit > 0 && queue->lanes[queue->servingLane].head != NULL) {
+                queue->servingCredit--;
+                return queue->servingLane;
+            }
+            queue->servingLane = (queue->servingLane + 1) % QUEUE_LANES;
+            queue->servingCredit = queue->weights[queue->servingLane];
+        }
+    }
+    int lane = 0;
+    while (queue->lanes[lane].head == NULL) {
+        lane++;
+    }
+    return lane;
 }
 
 void* dequeue(Queue *queue) {
     pthread_mutex_lock(&queue->mutex);
-    while (queue->head == NULL) {
+    while (queue->currentSize == 0) {
         pthread_cond_wait(&queue->cond, &queue->mutex);
     }
-    Node *temp = queue->head;
+    Node *temp = popLocked(&queue->lanes[nextLaneLocked(queue)]);
     void *data = temp->data;
-    queue->head = queue->head->next;
-    if (queue->head == NULL) {
-        queue->tail = NULL;
-    }
     queue->currentSize--;
-    free(temp);
+    freeNodeLocked(queue, temp);
     pthread_mutex_unlock(&queue->mutex);
     return data;
 }
+
+// Caller holds the queue mutex.
+static int takeBatchLocked(Queue *queue, void **items, int maxItems) {
+    int count = 0;
+    while (queue->currentSize > count && count < maxItems) {
+        Node *temp = popLocked(&queue->lanes[nextLaneLocked(queue)]);
+        items[count++] = temp->data;
+        freeNodeLocked(queue, temp);
+    }
+    queue->currentSize -= count;
+    return count;
+}
+
+/**
+ * Blocks until the queue has data, then takes up to maxItems in one lock.
+ *
+ * @return The number of items written to items, always at least one.
+ */
+int dequeueBatch(Queue *queue, void **items, int maxItems) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->currentSize == 0) {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+    int count = takeBatchLocked(queue, items, maxItems);
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+/**
+ * Takes up to maxItems without waiting.
+ *
+ * @return The number of items written to items, 0 if the queue was empty.
+ */
+int tryDequeueBatch(Queue *queue, void **items, int maxItems) {
+    pthread_mutex_lock(&queue->mutex);
+    int count = takeBatchLocked(queue, items, maxItems);
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
@@ -3,23 +3,43 @@
 
 #include <pthread.h>
 
+// Priority lanes per queue, lane 0 is served first and shed last.
+#define QUEUE_LANES 3
+// Lane used by enqueue and tryEnqueue.
+#define QUEUE_DEFAULT_LANE 1
 
 typedef struct Node {
     void *data;
     struct Node *next;
 } Node;
 
-typedef struct Queue {
+typedef struct Lane {
     Node *head;
     Node *tail;
+    int size;
+    unsigned long dropped;
+} Lane;
+
+typedef struct Queue {
+    Lane lanes[QUEUE_LANES];
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     int maxSize;
     int currentSize;
+    int weights[QUEUE_LANES];  // All 0 for strict priority
+    int servingLane;
+    int servingCredit;
+    Node *freeNodes;  // Recycled nodes, carved from chunks owned by the queue
 } Queue;
 
 Queue* initQueue(int maxSize);
-void enqueue(Queue *queue, void *data);
+void setQueueWeights(Queue *queue, const int *weights);
+int enqueue(Queue *queue, void *data);
+int tryEnqueue(Queue *queue, void *data);
+int enqueueLane(Queue *queue, void *data, int lane, void **evicted);
+int tryEnqueueLane(Queue *queue, void *data, int lane, void **evicted);
 void* dequeue(Queue *queue);
+int dequeueBatch(Queue *queue, void **items, int maxItems);
+int tryDequeueBatch(Queue *queue, void **items, int maxItems);
 
-#endif
\ No newline at end of file
+#endif
@@ -4,12 +4,14 @@
 #include <unistd.h>
 #include <pthread.h>
 #include "global.h"
+#include "watchdog.h"
 
 // Requeue is currently only being used to inject metrics into the worker threads
 // It is not being used to requeue packets that failed to send
 // the end goal is to use this to requeue packets that failed to send and to queue metrics
 
 Queue *requeue = NULL; 
+static volatile int requeueDraining = 0;
 
 struct RequeueArgs {
     Queue **queues;
@@ -25,16 +27,27 @@ void *requeue_thread(void *arg) {
 
     while (1) {
         for (int i = 0; i < max_threads; ++i) {
-            char *data = dequeue(requeue);
-            if (data != NULL) {
-                enqueue(queues[i], data);
+            if (watchdog_is_stalled(i)) {
+                continue;
             }
+            Packet *packet = dequeue(requeue);
+            if (packet != NULL && enqueuePacket(queues[i], packet) != 0) {
+                packet_release(packet);
+            }
+        }
+        if (!requeueDraining) {
+            sleep(1);  // Wait for 1 second before checking again
+        } else {
+            usleep(1000);  // Keeps the loop from spinning while every worker is stalled
         }
-        sleep(1);  // Wait for 1 second before checking again
     }
     return NULL;
 }
 
+void requeue_set_draining(int draining) {
+    requeueDraining = draining;
+}
+
 int init_requeue_thread(pthread_t *thread, int max_threads, Queue **worker_queues) {
     requeue = initQueue(10000); // Initialize with a size of 10,000
     struct RequeueArgs *args = malloc(sizeof(struct RequeueArgs));
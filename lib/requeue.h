@@ -6,5 +6,7 @@
 
 // Initialize the requeue thread
 int init_requeue_thread(pthread_t *thread, int max_threads, Queue **worker_queues);
+// Stop pacing the requeue so it empties as fast as the workers accept packets
+void requeue_set_draining(int draining);
 
 #endif // REQUEUE_H
@@ -0,0 +1,227 @@
+/**
+ * @file sockstats.c
+ * @brief Kernel socket buffer sizing and kernel drop visibility.
+ *
+ * Most loss happens in the kernel when a socket receive buffer overflows,
+ * before recvfrom ever sees the datagram. Two sources make it visible:
+ *
+ * - SO_RXQ_OVFL: the kernel attaches its running drop counter to every
+ *   datagram, the receive loop reports the highest value per batch.
+ * - /proc/net/udp: sampled every SOCKET_STATS_INTERVAL seconds for the
+ *   watched sockets, giving bytes waiting in the receive queue and drops.
+ *
+ * Both are injected as proxy metrics and served at /sockets.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "sockstats.h"
+#include "config_reader.h"
+#include "global.h"
+#include "logger.h"
+
+typedef struct {
+    int sock;
+    char name[32];
+    unsigned long inode;
+    int receiveBuffer;
+    unsigned long rxQueue;
+    unsigned long drops;
+    unsigned long lastDrops;
+    int found;
+} WatchedSocket;
+
+static WatchedSocket watched[SOCKSTATS_MAX_SOCKETS];
+static int watchedCount = 0;
+static uint32_t lastOverflow = 0;
+static unsigned long overflowDrops = 0;
+static unsigned long overflowDropsReported = 0;
+static int sampleInterval = 10;
+static pthread_mutex_t sockstats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Sets SO_RCVBUF or SO_SNDBUF, trying the FORCE variant first so a privileged
+ * process can go beyond net.core.rmem_max / wmem_max.
+ *
+ * @param sock    The socket.
+ * @param receive 1 for the receive buffer, 0 for the send buffer.
+ * @param size    Requested size in bytes, 0 keeps the kernel default.
+ * @param name    Socket name for the log.
+ * @return The size the kernel reports afterwards (it doubles the request for bookkeeping).
+ */
+int socket_set_buffer(int sock, int receive, int size, const char *name) {
+    int option = receive ? SO_RCVBUF : SO_SNDBUF;
+    if (size > 0) {
+        int forceOption = receive ? SO_RCVBUFFORCE : SO_SNDBUFFORCE;
+        if (setsockopt(sock, SOL_SOCKET, forceOption, &size, sizeof(size)) < 0 &&
+            setsockopt(sock, SOL_SOCKET, option, &size, sizeof(size)) < 0) {
+            write_log("setsockopt %s failed on %s", receive ? "SO_RCVBUF" : "SO_SNDBUF", name);
+        }
+    }
+
+    int effective = 0;
+    socklen_t optionLen = sizeof(effective);
+    getsockopt(sock, SOL_SOCKET, option, &effective, &optionLen);
+    if (size > 0 && effective < size) {
+        write_log("%s %s is %d bytes, below the %d requested (raise net.core.%s or run with CAP_NET_ADMIN)",
+                  name, receive ? "receive buffer" : "send buffer", effective, size, receive ? "rmem_max" : "wmem_max");
+    }
+    return effective;
+}
+
+/**
+ * Asks the kernel to attach its drop counter to every datagram on sock.
+ *
+ * @return 0 on success, -1 if SO_RXQ_OVFL is not supported.
+ */
+int sockstats_enable_overflow(int sock) {
+    int enabled = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &enabled, sizeof(enabled)) < 0) {
+        write_log("setsockopt SO_RXQ_OVFL failed, kernel drops are only sampled");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Records the highest SO_RXQ_OVFL counter seen in a receive batch.
+ */
+void sockstats_record_overflow(uint32_t counter) {
+    pthread_mutex_lock(&sockstats_mutex);
+    if (counter != lastOverflow) {
+        overflowDrops += (uint32_t)(counter - lastOverflow);  // The kernel counter wraps at 32 bits
+        lastOverflow = counter;
+    }
+    pthread_mutex_unlock(&sockstats_mutex);
+}
+
+/**
+ * Adds a UDP socket to the /proc/net/udp sampling.
+ */
+void sockstats_watch_udp(int sock, const char *name) {
+    if (watchedCount == SOCKSTATS_MAX_SOCKETS) {
+        return;
+    }
+    struct stat socketStat;
+    if (fstat(sock, &socketStat) < 0) {
+        return;
+    }
+    WatchedSocket *entry = &watched[watchedCount];
+    memset(entry, 0, sizeof(*entry));
+    entry->sock = sock;
+    strncpy(entry->name, name, sizeof(entry->name) - 1);
+    entry->inode = socketStat.st_ino;
+    socklen_t optionLen = sizeof(entry->receiveBuffer);
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &entry->receiveBuffer, &optionLen);
+    watchedCount++;
+}
+
+// Reads rx_queue and drops for every watched socket from one pass over /proc/net/udp.
+static void sample_proc_net_udp(void) {
+    FILE *file = fopen("/proc/net/udp", "r");
+    if (file == NULL) {
+        return;
+    }
+
+    char line[512];
+    fgets(line, sizeof(line), file);  // Header
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long txQueue, rxQueue, inode, drops;
+        // sl local rem st tx:rx tr:when retrnsmt uid timeout inode ref pointer drops
+        if (sscanf(line, "%*s %*s %*s %*s %lx:%lx %*s %*s %*s %*s %lu %*s %*s %lu",
+                   &txQueue, &rxQueue, &inode, &drops) != 4) {
+            continue;
+        }
+        pthread_mutex_lock(&sockstats_mutex);
+        for (int i = 0; i < watchedCount; ++i) {
+            if (watched[i].inode == inode) {
+                watched[i].rxQueue = rxQueue;
+                watched[i].drops = drops;
+                watched[i].found = 1;
+            }
+        }
+        pthread_mutex_unlock(&sockstats_mutex);
+    }
+    fclose(file);
+}
+
+static void *sockstats_thread(void *arg) {
+    set_thread_name("SocketStats");
+
+    while (1) {
+        sleep(sampleInterval);
+        sample_proc_net_udp();
+
+        pthread_mutex_lock(&sockstats_mutex);
+        unsigned long newOverflowDrops = overflowDrops - overflowDropsReported;
+        overflowDropsReported = overflowDrops;
+        pthread_mutex_unlock(&sockstats_mutex);
+        if (newOverflowDrops > 0) {
+            injectMetric("socket.kernel_drops", (int)newOverflowDrops);
+        }
+
+        for (int i = 0; i < watchedCount; ++i) {
+            pthread_mutex_lock(&sockstats_mutex);
+            WatchedSocket entry = watched[i];
+            watched[i].lastDrops = watched[i].drops;
+            pthread_mutex_unlock(&sockstats_mutex);
+            if (!entry.found) {
+                continue;
+            }
+
+            char metric_name[128];
+            snprintf(metric_name, sizeof(metric_name), "socket.%s.rx_queue_bytes", entry.name);
+            injectMetric(metric_name, (int)entry.rxQueue);
+            if (entry.drops > entry.lastDrops) {
+                snprintf(metric_name, sizeof(metric_name), "socket.%s.drops", entry.name);
+                injectMetric(metric_name, (int)(entry.drops - entry.lastDrops));
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Starts the sampler for the sockets registered with sockstats_watch_udp.
+ *
+ * @return 0 on success, -1 if the thread could not be created.
+ */
+int sockstats_init(void) {
+    sampleInterval = config.SOCKET_STATS_INTERVAL > 0 ? config.SOCKET_STATS_INTERVAL : 10;
+    sample_proc_net_udp();
+    for (int i = 0; i < watchedCount; ++i) {
+        watched[i].lastDrops = watched[i].drops;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, sockstats_thread, NULL) != 0) {
+        write_log("Could not create socket stats thread");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+/**
+ * Writes buffer sizes, receive queue usage and drop counters as plain text.
+ *
+ * @return Number of bytes written to out.
+ */
+int sockstats_report(char *out, size_t outSize) {
+    sample_proc_net_udp();
+
+    pthread_mutex_lock(&sockstats_mutex);
+    int written = snprintf(out, outSize, "kernel_drops_rxq_ovfl %lu\nsocket rcvbuf rx_queue_bytes drops\n", overflowDrops);
+    for (int i = 0; i < watchedCount && written < (int)outSize; ++i) {
+        written += snprintf(out + written, outSize - written, "%s %d %lu %lu\n",
+                            watched[i].name, watched[i].receiveBuffer, watched[i].rxQueue, watched[i].drops);
+    }
+    pthread_mutex_unlock(&sockstats_mutex);
+
+    return written < (int)outSize ? written : (int)outSize - 1;
+}
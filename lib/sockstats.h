@@ -0,0 +1,16 @@
+#ifndef SOCKSTATS_H
+#define SOCKSTATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SOCKSTATS_MAX_SOCKETS 4
+
+int socket_set_buffer(int sock, int receive, int size, const char *name);
+int sockstats_enable_overflow(int sock);
+void sockstats_record_overflow(uint32_t counter);
+void sockstats_watch_udp(int sock, const char *name);
+int sockstats_init(void);
+int sockstats_report(char *out, size_t outSize);
+
+#endif // SOCKSTATS_H
@@ -0,0 +1,318 @@
+/**
+ * @file sources.c
+ * @brief Heavy hitter accounting and optional rate limits per client address.
+ *
+ * The noisiest senders are tracked with the Space-Saving algorithm: a fixed
+ * table of SOURCE_TOPK_SIZE counters where an unknown address takes over the
+ * smallest counter. Any address sending more than 1/SOURCE_TOPK_SIZE of the
+ * packets is guaranteed to be in the table, and "error" is the most its count
+ * can be overstated by. The counters form a min-heap on packets, so the
+ * smallest is always at the root, and an open addressing index maps each
+ * address to its heap position, so counting a packet is O(log K).
+ *
+ * When SOURCE_RATE_LIMIT is set, each address also draws from a token bucket.
+ * Buckets live in a fixed table indexed by address hash, addresses that
+ * collide share a bucket, so memory never grows with the number of clients.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "sources.h"
+#include "config_reader.h"
+#include "global.h"
+#include "logger.h"
+
+#define SOURCES_RATE_BITS 12
+#define SOURCES_RATE_SLOTS (1 << SOURCES_RATE_BITS)
+
+typedef struct {
+    uint32_t address;
+    unsigned long packets;
+    unsigned long bytes;
+    unsigned long error;
+    unsigned long rateLimited;
+} SourceCounter;
+
+typedef struct {
+    uint32_t address;
+    int position;  // Heap position + 1, 0 marks an empty entry
+} CounterIndex;
+
+typedef struct {
+    double tokens;
+    double lastRefill;
+} TokenBucket;
+
+static SourceCounter *counters = NULL;
+static SourceCounter *lastCounters = NULL;
+static int counterCount = 0;
+static CounterIndex *counterIndex = NULL;
+static uint32_t indexMask = 0;
+static int indexBits = 0;
+static int lastCounterCount = 0;
+static int topkSize = 64;
+static int intervalSeconds = 60;
+static time_t intervalStart = 0;
+static TokenBucket *buckets = NULL;
+static double rateLimit = 0;
+static double rateBurst = 0;
+static unsigned long rateLimitedTotal = 0;
+static pthread_mutex_t sources_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int compare_counters(const void *a, const void *b) {
+    const SourceCounter *left = a;
+    const SourceCounter *right = b;
+    if (left->packets != right->packets) {
+        return left->packets < right->packets ? 1 : -1;
+    }
+    return 0;
+}
+
+// Closes the interval when it has expired, caller holds the mutex.
+static void maybe_rollover(time_t now) {
+    if (difftime(now, intervalStart) < intervalSeconds) {
+        return;
+    }
+    memcpy(lastCounters, counters, sizeof(SourceCounter) * counterCount);
+    lastCounterCount = counterCount;
+    qsort(lastCounters, lastCounterCount, sizeof(SourceCounter), compare_counters);
+    memset(counters, 0, sizeof(SourceCounter) * topkSize);
+    memset(counterIndex, 0, sizeof(CounterIndex) * (indexMask + 1));
+    counterCount = 0;
+    intervalStart = now;
+
+    if (rateLimitedTotal > 0) {
+        injectMetric("sources.rate_limited", (int)rateLimitedTotal);
+        rateLimitedTotal = 0;
+    }
+}
+
+static uint32_t index_home(uint32_t address) {
+    return (address * 2654435761u) >> (32 - indexBits);
+}
+
+static CounterIndex *index_find(uint32_t address) {
+    for (uint32_t slot = index_home(address); ; slot = (slot + 1) & indexMask) {
+        if (counterIndex[slot].position == 0 || counterIndex[slot].address == address) {
+            return &counterIndex[slot];
+        }
+    }
+}
+
+// Removes an address with backward shift deletion, so lookups never need tombstones.
+static void index_remove(uint32_t address) {
+    CounterIndex *entry = index_find(address);
+    uint32_t hole = (uint32_t)(entry - counterIndex);
+    counterIndex[hole].position = 0;
+    for (uint32_t slot = (hole + 1) & indexMask; counterIndex[slot].position != 0; slot = (slot + 1) & indexMask) {
+        uint32_t home = index_home(counterIndex[slot].address);
+        // Move the entry back if its home is not between the hole and its slot.
+        if (((slot - home) & indexMask) >= ((slot - hole) & indexMask)) {
+            counterIndex[hole] = counterIndex[slot];
+            counterIndex[slot].position = 0;
+            hole = slot;
+        }
+    }
+}
+
+static void heap_swap(int a, int b) {
+    SourceCounter swapped = counters[a];
+    counters[a] = counters[b];
+    counters[b] = swapped;
+    index_find(counters[a].address)->position = a + 1;
+    index_find(counters[b].address)->position = b + 1;
+}
+
+static void heap_sift_down(int position) {
+    while (1) {
+        int smallest = position;
+        int left = 2 * position + 1;
+        int right = left + 1;
+        if (left < counterCount && counters[left].packets < counters[smallest].packets) {
+            smallest = left;
+        }
+        if (right < counterCount && counters[right].packets < counters[smallest].packets) {
+            smallest = right;
+        }
+        if (smallest == position) {
+            return;
+        }
+        heap_swap(position, smallest);
+        position = smallest;
+    }
+}
+
+// Counts a packet against its sender, caller holds the mutex.
+static void count_packet(uint32_t address, int len, bool rateLimited) {
+    CounterIndex *entry = index_find(address);
+    int position;
+    if (entry->position != 0) {
+        position = entry->position - 1;
+    } else if (counterCount < topkSize) {
+        // A new counter starts at zero, which is never above its parent.
+        position = counterCount++;
+        memset(&counters[position], 0, sizeof(SourceCounter));
+        counters[position].address = address;
+        entry->address = address;
+        entry->position = position + 1;
+        while (position > 0) {
+            int parent = (position - 1) / 2;
+            heap_swap(position, parent);
+            position = parent;
+        }
+    } else {
+        // Space-Saving: the newcomer takes over the smallest counter, its count becomes the possible error.
+        position = 0;
+        index_remove(counters[0].address);
+        counters[0].address = address;
+        counters[0].error = counters[0].packets;
+        counters[0].rateLimited = 0;
+        entry = index_find(address);
+        entry->address = address;
+        entry->position = 1;
+    }
+
+    counters[position].packets++;
+    counters[position].bytes += len;
+    if (rateLimited) {
+        counters[position].rateLimited++;
+    }
+    heap_sift_down(position);
+}
+
+static bool take_token(uint32_t address) {
+    // Fibonacci hashing, the top bits depend on every byte of the address.
+    uint32_t slot = (address * 2654435761u) >> (32 - SOURCES_RATE_BITS);
+    TokenBucket *bucket = &buckets[slot];
+    double now = now_seconds();
+    if (bucket->lastRefill == 0) {
+        bucket->tokens = rateBurst;
+    } else {
+        bucket->tokens += (now - bucket->lastRefill) * rateLimit;
+        if (bucket->tokens > rateBurst) {
+            bucket->tokens = rateBurst;
+        }
+    }
+    bucket->lastRefill = now;
+    if (bucket->tokens < 1.0) {
+        return false;
+    }
+    bucket->tokens -= 1.0;
+    return true;
+}
+
+/**
+ * Allocates the counter table and, when SOURCE_RATE_LIMIT is set, the token buckets.
+ *
+ * @return 0 on success, -1 if the tables could not be allocated.
+ */
+int sources_init(void) {
+    topkSize = config.SOURCE_TOPK_SIZE > 0 ? config.SOURCE_TOPK_SIZE : 64;
+    intervalSeconds = config.SOURCE_TOPK_INTERVAL > 0 ? config.SOURCE_TOPK_INTERVAL : 60;
+    counters = calloc(topkSize, sizeof(SourceCounter));
+    lastCounters = calloc(topkSize, sizeof(SourceCounter));
+    // At most half full, so probes stay short.
+    indexBits = 1;
+    while ((1 << indexBits) < topkSize * 2) {
+        indexBits++;
+    }
+    indexMask = (1u << indexBits) - 1;
+    counterIndex = calloc(indexMask + 1, sizeof(CounterIndex));
+    if (counters == NULL || lastCounters == NULL || counterIndex == NULL) {
+        write_log("Failed to allocate source counters");
+        return -1;
+    }
+
+    if (config.SOURCE_RATE_LIMIT > 0) {
+        rateLimit = config.SOURCE_RATE_LIMIT;
+        rateBurst = config.SOURCE_RATE_BURST > 0 ? config.SOURCE_RATE_BURST : rateLimit;
+        buckets = calloc(SOURCES_RATE_SLOTS, sizeof(TokenBucket));
+        if (buckets == NULL) {
+            write_log("Failed to allocate source rate limits");
+            return -1;
+        }
+        write_log("Source rate limit: %.0f packets/s, burst %.0f", rateLimit, rateBurst);
+    }
+    intervalStart = time(NULL);
+    return 0;
+}
+
+/**
+ * Counts a datagram against its sender and applies the sender's rate limit.
+ *
+ * @param source Address the datagram came from.
+ * @param len    Size of the datagram in bytes.
+ * @return false if the sender is over its rate limit and the datagram should be dropped.
+ */
+bool sources_admit(const struct sockaddr_in *source, int len) {
+    if (counters == NULL) {
+        return true;
+    }
+    uint32_t address = source->sin_addr.s_addr;
+
+    pthread_mutex_lock(&sources_mutex);
+    maybe_rollover(time(NULL));
+    bool admitted = buckets == NULL || take_token(address);
+    if (!admitted) {
+        rateLimitedTotal++;
+    }
+    count_packet(address, len, !admitted);
+    pthread_mutex_unlock(&sources_mutex);
+    return admitted;
+}
+
+static int append_counters(char *out, size_t outSize, int written, const char *title,
+                           const SourceCounter *list, int count) {
+    written += snprintf(out + written, outSize - written, "%s\nsource packets bytes error rate_limited\n", title);
+    for (int i = 0; i < count && written < (int)outSize; ++i) {
+        char ip[INET_ADDRSTRLEN];
+        struct in_addr address = { list[i].address };
+        inet_ntop(AF_INET, &address, ip, sizeof(ip));
+        written += snprintf(out + written, outSize - written, "%s %lu %lu %lu %lu\n",
+                            ip, list[i].packets, list[i].bytes, list[i].error, list[i].rateLimited);
+    }
+    return written;
+}
+
+/**
+ * Writes the top sources of the current and previous interval as plain text.
+ *
+ * @return Number of bytes written to out.
+ */
+int sources_report(char *out, size_t outSize) {
+    if (counters == NULL) {
+        return snprintf(out, outSize, "source tracking disabled\n");
+    }
+
+    SourceCounter *current = malloc(sizeof(SourceCounter) * topkSize);
+    if (current == NULL) {
+        return snprintf(out, outSize, "out of memory\n");
+    }
+    pthread_mutex_lock(&sources_mutex);
+    maybe_rollover(time(NULL));
+    int currentCount = counterCount;
+    memcpy(current, counters, sizeof(SourceCounter) * currentCount);
+    int written = snprintf(out, outSize, "topk %d\ninterval %d\nrate_limit %.0f\nrate_burst %.0f\n",
+                           topkSize, intervalSeconds, rateLimit, rateBurst);
+    qsort(current, currentCount, sizeof(SourceCounter), compare_counters);
+    if (written < (int)outSize) {
+        written = append_counters(out, outSize, written, "current_interval", current, currentCount);
+    }
+    if (written < (int)outSize) {
+        written = append_counters(out, outSize, written, "previous_interval", lastCounters, lastCounterCount);
+    }
+    pthread_mutex_unlock(&sources_mutex);
+    free(current);
+
+    return written < (int)outSize ? written : (int)outSize - 1;
+}
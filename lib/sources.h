@@ -0,0 +1,12 @@
+#ifndef SOURCES_H
+#define SOURCES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+int sources_init(void);
+bool sources_admit(const struct sockaddr_in *source, int len);
+int sources_report(char *out, size_t outSize);
+
+#endif // SOURCES_H
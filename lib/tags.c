@@ -0,0 +1,244 @@
+/**
+ * @file tags.c
+ * @brief DogStatsD tag parsing and normalization.
+ *
+ * A DogStatsD line carries its tags in a "|#" section, for example
+ * "name:1|c|@0.5|#env:prod,host:a". The section ends at the next '|' or at the
+ * end of the line. normalizeMetricTags rewrites that section in place so that
+ * identical series always produce identical bytes: configured tags are
+ * stripped or injected, then the tags are sorted and duplicates removed.
+ *
+ * Tags are handled as (offset, length) pairs on the stack, there is no heap
+ * allocation per line.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "tags.h"
+#include "config_reader.h"
+#include "logger.h"
+
+#define TAGS_SCRATCH_SIZE 2048
+
+typedef struct {
+    const char *text;
+    int len;
+} Tag;
+
+static const char *tag_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-.:/";
+
+static char injectStorage[sizeof(config.TAGS_INJECT)];
+static char stripStorage[sizeof(config.TAGS_STRIP)];
+static Tag injectTags[TAGS_MAX_CONFIGURED];
+static int injectCount = 0;
+static Tag stripKeys[TAGS_MAX_CONFIGURED];
+static int stripCount = 0;
+
+static bool isTagValid(const char *tag, int len) {
+    if (len == 0) {
+        return false;
+    }
+    for (int i = 0; i < len; ++i) {
+        if (tag[i] == '\0' || strchr(tag_chars, tag[i]) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int tagKeyLen(const Tag *tag) {
+    const char *colon = memchr(tag->text, ':', tag->len);
+    return colon != NULL ? (int)(colon - tag->text) : tag->len;
+}
+
+static bool sameKey(const Tag *tag, const Tag *key) {
+    return tagKeyLen(tag) == key->len && memcmp(tag->text, key->text, key->len) == 0;
+}
+
+static int compareTags(const Tag *a, const Tag *b) {
+    int shorter = a->len < b->len ? a->len : b->len;
+    int result = memcmp(a->text, b->text, shorter);
+    if (result != 0) {
+        return result;
+    }
+    return a->len - b->len;
+}
+
+// Splits a comma separated list from the config into storage, returns the number of tags kept.
+static int parseConfiguredTags(const char *value, char *storage, size_t storageSize, Tag *out, bool keysOnly) {
+    int count = 0;
+    strncpy(storage, value, storageSize - 1);
+    storage[storageSize - 1] = '\0';
+
+    char *saveptr;
+    for (char *token = strtok_r(storage, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+        int len = (int)strlen(token);
+        if (strspn(token, " \t\r\n") == (size_t)len) {
+            continue;  // An empty setting arrives as a lone newline
+        }
+        if (!isTagValid(token, len) || (keysOnly && memchr(token, ':', len) != NULL)) {
+            write_log("Ignoring invalid configured tag: %s", token);
+            continue;
+        }
+        if (count == TAGS_MAX_CONFIGURED) {
+            write_log("Too many configured tags, ignoring: %s", token);
+            continue;
+        }
+        out[count].text = token;
+        out[count].len = len;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Parses TAGS_INJECT and TAGS_STRIP from the config.
+ *
+ * @return 0 on success.
+ */
+int tags_init(void) {
+    injectCount = parseConfiguredTags(config.TAGS_INJECT, injectStorage, sizeof(injectStorage), injectTags, false);
+    stripCount = parseConfiguredTags(config.TAGS_STRIP, stripStorage, sizeof(stripStorage), stripKeys, true);
+    if (injectCount > 0 || stripCount > 0) {
+        write_log("Tag normalization: injecting %d tags, stripping %d keys", injectCount, stripCount);
+    }
+    return 0;
+}
+
+/**
+ * Validates the body of a "|#" section, a comma separated list of tags.
+ *
+ * @param tags Start of the section, just after "|#".
+ * @param len  Length of the section.
+ * @return true when every tag is non empty and uses only allowed characters.
+ */
+bool isTagSectionValid(const char *tags, int len) {
+    int start = 0;
+    for (int i = 0; i <= len; ++i) {
+        if (i == len || tags[i] == ',') {
+            if (!isTagValid(tags + start, i - start)) {
+                return false;
+            }
+            start = i + 1;
+        }
+    }
+    return true;
+}
+
+/**
+ * Canonicalizes the tag section of a validated metric line in place.
+ *
+ * Client tags whose key is listed in TAGS_STRIP or TAGS_INJECT are removed,
+ * TAGS_INJECT is added, and the result is sorted and deduplicated. A line
+ * without tags only changes when there is something to inject.
+ *
+ * @param metric   The metric line, null terminated.
+ * @param len      Length of the line.
+ * @param capacity Size of the buffer holding the line.
+ * @return The new length of the line, or -1 if the tags are invalid or the result does not fit.
+ */
+int normalizeMetricTags(char *metric, int len, int capacity) {
+    char *section = NULL;
+    for (char *hash = memchr(metric, '#', len); hash != NULL; hash = memchr(hash + 1, '#', len - (hash + 1 - metric))) {
+        if (hash > metric && hash[-1] == '|') {
+            section = hash + 1;
+            break;
+        }
+    }
+    if (section == NULL && injectCount == 0) {
+        return len;
+    }
+
+    Tag tags[TAGS_MAX_PER_LINE + TAGS_MAX_CONFIGURED];
+    int count = 0;
+    int sectionLen = 0;
+    if (section != NULL) {
+        char *sectionEnd = memchr(section, '|', len - (section - metric));
+        sectionLen = sectionEnd != NULL ? (int)(sectionEnd - section) : len - (int)(section - metric);
+
+        int start = 0;
+        for (int i = 0; i <= sectionLen; ++i) {
+            if (i < sectionLen && section[i] != ',') {
+                continue;
+            }
+            Tag tag = { section + start, i - start };
+            start = i + 1;
+            if (!isTagValid(tag.text, tag.len)) {
+                return -1;
+            }
+
+            bool keep = true;
+            for (int s = 0; s < stripCount && keep; ++s) {
+                keep = !sameKey(&tag, &stripKeys[s]);
+            }
+            for (int s = 0; s < injectCount && keep; ++s) {
+                Tag injectKey = { injectTags[s].text, tagKeyLen(&injectTags[s]) };
+                keep = !sameKey(&tag, &injectKey);
+            }
+            if (!keep) {
+                continue;
+            }
+            if (count == TAGS_MAX_PER_LINE) {
+                return -1;
+            }
+            tags[count++] = tag;
+        }
+    }
+    for (int s = 0; s < injectCount; ++s) {
+        tags[count++] = injectTags[s];
+    }
+
+    // Insertion sort, lines carry a handful of tags.
+    for (int i = 1; i < count; ++i) {
+        Tag current = tags[i];
+        int j = i - 1;
+        while (j >= 0 && compareTags(&tags[j], &current) > 0) {
+            tags[j + 1] = tags[j];
+            j--;
+        }
+        tags[j + 1] = current;
+    }
+
+    char scratch[TAGS_SCRATCH_SIZE];
+    int scratchLen = 0;
+    for (int i = 0; i < count; ++i) {
+        if (i > 0 && compareTags(&tags[i - 1], &tags[i]) == 0) {
+            continue;
+        }
+        if (scratchLen + tags[i].len + 1 > TAGS_SCRATCH_SIZE) {
+            return -1;
+        }
+        if (scratchLen > 0) {
+            scratch[scratchLen++] = ',';
+        }
+        memcpy(scratch + scratchLen, tags[i].text, tags[i].len);
+        scratchLen += tags[i].len;
+    }
+
+    if (section == NULL) {
+        // Nothing to remove, append a new section.
+        if (len + 2 + scratchLen >= capacity) {
+            return -1;
+        }
+        metric[len++] = '|';
+        metric[len++] = '#';
+        memcpy(metric + len, scratch, scratchLen);
+        len += scratchLen;
+        metric[len] = '\0';
+        return len;
+    }
+
+    int sectionOffset = (int)(section - metric);
+    int tailLen = len - sectionOffset - sectionLen;
+    if (scratchLen == 0) {
+        // Every tag was stripped, drop the "|#" marker too.
+        sectionOffset -= 2;
+    }
+    int newLen = sectionOffset + scratchLen + tailLen;
+    if (newLen >= capacity) {
+        return -1;
+    }
+    memmove(metric + sectionOffset + scratchLen, section + sectionLen, tailLen);
+    memcpy(metric + sectionOffset, scratch, scratchLen);
+    metric[newLen] = '\0';
+    return newLen;
+}
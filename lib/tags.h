@@ -0,0 +1,13 @@
+#ifndef TAGS_H
+#define TAGS_H
+
+#include <stdbool.h>
+
+#define TAGS_MAX_PER_LINE 64
+#define TAGS_MAX_CONFIGURED 16
+
+int tags_init(void);
+bool isTagSectionValid(const char *tags, int len);
+int normalizeMetricTags(char *metric, int len, int capacity);
+
+#endif // TAGS_H
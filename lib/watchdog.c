@@ -0,0 +1,238 @@
+/**
+ * @file watchdog.c
+ * @brief Detects workers that stop making progress and moves their backlog.
+ *
+ * Workers publish a heartbeat after every packet they deliver or drop: the
+ * time of the last dequeue and a processed counter. A send that timed out
+ * after OUTBOUND_UDP_TIMEOUT does not beat, so a worker crawling through its
+ * queue one timeout at a time counts as stuck. The supervisor calls
+ * watchdog_check once a second. A worker whose queue holds packets but whose
+ * counter has not moved for WORKER_STALL_TIMEOUT seconds is marked stalled:
+ * ingress and the requeue skip it, and its queued packets are handed to the
+ * healthy workers. The stall is recorded as open right away and closed with
+ * its duration when the worker moves again.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "watchdog.h"
+#include "packet.h"
+#include "config_reader.h"
+#include "global.h"
+#include "logger.h"
+
+#define WATCHDOG_MOVE_BATCH 256
+
+typedef struct {
+    time_t lastDequeue;
+    unsigned long processed;
+    unsigned long lastChecked;
+    time_t lastProgress;
+    int stalled;
+    time_t stallStart;
+    unsigned long moved;
+    int stallEvent;  // Position of the open stall in the history
+} WorkerHeartbeat;
+
+typedef struct {
+    int worker;
+    time_t start;
+    long durationSeconds;  // -1 while the stall is open
+    unsigned long moved;
+} StallEvent;
+
+static WorkerHeartbeat *heartbeats = NULL;
+static int workerCount = 0;
+static int stallTimeout = 5;
+static StallEvent events[WATCHDOG_EVENT_HISTORY];
+static int eventCount = 0;
+static unsigned long stallTotal = 0;
+static pthread_mutex_t watchdog_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Allocates one heartbeat per worker.
+ *
+ * @return 0 on success, -1 if the allocation failed.
+ */
+int watchdog_init(int workers) {
+    heartbeats = calloc(workers, sizeof(WorkerHeartbeat));
+    if (heartbeats == NULL) {
+        return -1;
+    }
+    workerCount = workers;
+    stallTimeout = config.WORKER_STALL_TIMEOUT > 0 ? config.WORKER_STALL_TIMEOUT : 5;
+    time_t now = time(NULL);
+    for (int i = 0; i < workers; ++i) {
+        heartbeats[i].lastProgress = now;
+    }
+    return 0;
+}
+
+/**
+ * Called by a worker after each packet it has handled.
+ */
+void watchdog_beat(int worker) {
+    if (heartbeats == NULL || worker >= workerCount) {
+        return;
+    }
+    heartbeats[worker].lastDequeue = time(NULL);
+    __atomic_add_fetch(&heartbeats[worker].processed, 1, __ATOMIC_RELEASE);
+}
+
+int watchdog_is_stalled(int worker) {
+    return heartbeats != NULL && __atomic_load_n(&heartbeats[worker].stalled, __ATOMIC_RELAXED);
+}
+
+// Adds an open stall to the history, returns its position.
+static int open_event(int worker, time_t start) {
+    pthread_mutex_lock(&watchdog_mutex);
+    int position = eventCount++;
+    StallEvent *event = &events[position % WATCHDOG_EVENT_HISTORY];
+    event->worker = worker;
+    event->start = start;
+    event->durationSeconds = -1;
+    event->moved = 0;
+    pthread_mutex_unlock(&watchdog_mutex);
+    return position;
+}
+
+// Closes an open stall, unless later stalls have pushed it out of the history.
+static void close_event(int position, long durationSeconds, unsigned long moved) {
+    pthread_mutex_lock(&watchdog_mutex);
+    if (eventCount - position <= WATCHDOG_EVENT_HISTORY) {
+        StallEvent *event = &events[position % WATCHDOG_EVENT_HISTORY];
+        event->durationSeconds = durationSeconds;
+        event->moved = moved;
+    }
+    pthread_mutex_unlock(&watchdog_mutex);
+}
+
+// Hands the backlog of a stalled worker to the others, returns how many packets moved.
+static unsigned long move_backlog(Queue **queues, int stalledWorker) {
+    void *items[WATCHDOG_MOVE_BATCH];
+    unsigned long moved = 0;
+    int target = stalledWorker;
+    int count;
+
+    while ((count = tryDequeueBatch(queues[stalledWorker], items, WATCHDOG_MOVE_BATCH)) > 0) {
+        for (int i = 0; i < count; ++i) {
+            int placed = 0;
+            for (int tries = 0; tries < workerCount && !placed; ++tries) {
+                target = (target + 1) % workerCount;
+                if (target != stalledWorker && !watchdog_is_stalled(target)) {
+                    placed = tryEnqueueLane(queues[target], items[i], ((Packet *)items[i])->priority, NULL) == 0;
+                }
+            }
+            if (placed) {
+                moved++;
+            } else {
+                packet_release(items[i]);  // Every healthy queue is full
+            }
+        }
+    }
+    return moved;
+}
+
+/**
+ * Compares every worker's progress with its backlog, called by the supervisor.
+ */
+void watchdog_check(Queue **queues, int workers) {
+    if (heartbeats == NULL) {
+        return;
+    }
+    time_t now = time(NULL);
+
+    int healthy = 0;
+    for (int i = 0; i < workers; ++i) {
+        healthy += !watchdog_is_stalled(i);
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        WorkerHeartbeat *heartbeat = &heartbeats[i];
+        unsigned long processed = __atomic_load_n(&heartbeat->processed, __ATOMIC_ACQUIRE);
+        pthread_mutex_lock(&queues[i]->mutex);
+        int backlog = queues[i]->currentSize;
+        pthread_mutex_unlock(&queues[i]->mutex);
+
+        int advanced = processed != heartbeat->lastChecked;
+        heartbeat->lastChecked = processed;
+
+        if (heartbeat->stalled) {
+            if (advanced) {
+                long duration = (long)difftime(now, heartbeat->stallStart);
+                __atomic_store_n(&heartbeat->stalled, 0, __ATOMIC_RELAXED);
+                healthy++;
+                heartbeat->lastProgress = now;
+                close_event(heartbeat->stallEvent, duration, heartbeat->moved);
+                write_log("Worker %d recovered after a %ld second stall, %lu packets were moved", i, duration, heartbeat->moved);
+                injectMetric("watchdog.stall_seconds", (int)duration);
+            } else {
+                // Packets enqueued just before the worker was skipped.
+                heartbeat->moved += move_backlog(queues, i);
+            }
+            continue;
+        }
+
+        // An idle worker waiting on an empty queue is not stalled.
+        if (advanced || backlog == 0) {
+            heartbeat->lastProgress = now;
+            continue;
+        }
+        if (difftime(now, heartbeat->lastProgress) < stallTimeout || healthy <= 1) {
+            // With no healthy worker left to take the queue, keep waiting on it.
+            continue;
+        }
+
+        __atomic_store_n(&heartbeat->stalled, 1, __ATOMIC_RELAXED);
+        healthy--;
+        heartbeat->stallStart = heartbeat->lastProgress;
+        __atomic_add_fetch(&stallTotal, 1, __ATOMIC_RELAXED);
+        write_log("Worker %d stalled: no progress for %ld seconds with %d packets queued",
+                  i, (long)difftime(now, heartbeat->lastProgress), backlog);
+        injectMetric("watchdog.stalls", 1);
+        heartbeat->stallEvent = open_event(i, heartbeat->stallStart);
+        heartbeat->moved = move_backlog(queues, i);
+    }
+}
+
+/**
+ * Writes the state of each worker and the recent stall events as plain text.
+ *
+ * @return Number of bytes written to out.
+ */
+int watchdog_report(char *out, size_t outSize) {
+    if (heartbeats == NULL) {
+        return snprintf(out, outSize, "watchdog not running\n");
+    }
+    time_t now = time(NULL);
+    int written = snprintf(out, outSize, "stall_timeout %d\nstalls_total %lu\nworker processed last_dequeue_age stalled stalled_for moved\n",
+                           stallTimeout, __atomic_load_n(&stallTotal, __ATOMIC_RELAXED));
+    for (int i = 0; i < workerCount && written < (int)outSize; ++i) {
+        WorkerHeartbeat *heartbeat = &heartbeats[i];
+        int stalled = watchdog_is_stalled(i);
+        written += snprintf(out + written, outSize - written, "%d %lu %ld %d %ld %lu\n",
+                            i, __atomic_load_n(&heartbeat->processed, __ATOMIC_RELAXED),
+                            heartbeat->lastDequeue != 0 ? (long)difftime(now, heartbeat->lastDequeue) : -1,
+                            stalled, stalled ? (long)difftime(now, heartbeat->stallStart) : 0,
+                            stalled ? heartbeat->moved : 0);
+    }
+
+    pthread_mutex_lock(&watchdog_mutex);
+    if (written < (int)outSize) {
+        written += snprintf(out + written, outSize - written, "recent_stalls\nworker started_ago duration moved open\n");
+    }
+    int first = eventCount > WATCHDOG_EVENT_HISTORY ? eventCount - WATCHDOG_EVENT_HISTORY : 0;
+    for (int e = eventCount - 1; e >= first && written < (int)outSize; --e) {
+        StallEvent *event = &events[e % WATCHDOG_EVENT_HISTORY];
+        int open = event->durationSeconds < 0;
+        long startedAgo = (long)difftime(now, event->start);
+        written += snprintf(out + written, outSize - written, "%d %ld %ld %lu %d\n",
+                            event->worker, startedAgo, open ? startedAgo : event->durationSeconds,
+                            open ? heartbeats[event->worker].moved : event->moved, open);
+    }
+    pthread_mutex_unlock(&watchdog_mutex);
+
+    return written < (int)outSize ? written : (int)outSize - 1;
+}
@@ -0,0 +1,15 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stddef.h>
+#include "queue.h"
+
+#define WATCHDOG_EVENT_HISTORY 32
+
+int watchdog_init(int workers);
+void watchdog_beat(int worker);
+int watchdog_is_stalled(int worker);
+void watchdog_check(Queue **queues, int workers);
+int watchdog_report(char *out, size_t outSize);
+
+#endif // WATCHDOG_H
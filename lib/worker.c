@@ -10,10 +10,10 @@
 #include "logger.h"
 #include "global.h"
 #include "config_reader.h"
+#include "destination.h"
+#include "watchdog.h"
+#include <errno.h>
 
-extern int CLONE_ENABLED;
-extern int CLONE_DEST_UDP_PORT;
-extern char CLONE_DEST_UDP_IP[];
 extern Queue **queues;
 
 struct WorkerArgs {
@@ -22,6 +22,7 @@ struct WorkerArgs {
     struct sockaddr_in destAddr;
     int workerID;
     int bufferSize;
+    DestinationHealth *health;
 };
 
 /**
@@ -29,23 +30,22 @@ struct WorkerArgs {
  * 
  * This function serves as the entry point for worker threads. It is responsible for
  * dequeuing packets from a unique queue for each thread and sending them via UDP. 
- * It also handles metrics collection and error tracking. The function runs 
+ * It also handles metrics collection and error tracking. Clone and fanout
+ * destinations are served by their own threads, see fanout.c. The function runs 
  * indefinitely, but will exit if there are no packets to process for a specific 
  * time period.
  * 
  * @param arg A pointer to a WorkerArgs structure containing:
  *            - queue: Pointer to a Queue structure for packet storage.
- *            - udpSocket: File descriptor for the UDP socket.
+ *            - udpSocket: File descriptor for this worker's UDP socket, connected to the destination.
  *            - destAddr: Destination address for the UDP packets.
  *            - workerID: An identifier for the worker thread, used for logging.
  *            - bufferSize: The size of the packet buffer.
+ *            - health: Send and ICMP error counters of the destination.
  * 
  * @return NULL Always returns NULL, but can also exit the thread upon inactivity.
  *
- * @note This function uses several global constants and functions including:
- *       - CLONE_DEST_UDP_PORT
- *       - CLONE_DEST_UDP_IP
- *       - CLONE_ENABLED
+ * @note This function uses several global functions including:
  *       - set_thread_name()
  *       - write_log()
  *       - injectMetric()
@@ -65,8 +65,7 @@ void *worker_thread(void *arg) {
     // Initialize variables from the argument structure.
     Queue *queue = args->queue;
     int udpSocket = args->udpSocket;
-    struct sockaddr_in destAddr = args->destAddr;
-    struct sockaddr_in cloneDestAddr;
+    DestinationHealth *health = args->health;
 
     // Create and set the thread name for debugging and logging.
     char thread_name[16]; // 15 characters + null terminator
@@ -76,11 +75,6 @@ void *worker_thread(void *arg) {
     // Initialize time variable for tracking last packet time.
     time_t last_packet_time = time(NULL);
 
-    // Initialize variables for the destination address of the cloned packets.
-    cloneDestAddr.sin_family = AF_INET;
-    cloneDestAddr.sin_port = htons(config.CLONE_DEST_UDP_PORT);
-    inet_aton(config.CLONE_DEST_UDP_IP, &cloneDestAddr.sin_addr);
-
     // Initialize error tracking variables.
     int error_counter = 0;
     time_t error_time = 0;
@@ -96,10 +90,10 @@ void *worker_thread(void *arg) {
     // Main loop to process incoming packets.
     while (1) {
         // Dequeue a packet from the unique queue.
-        char *buffer = dequeue(queue);
+        Packet *packet = dequeue(queue);
 
         // If a packet is available.
-        if (buffer != NULL) {
+        if (packet != NULL) {
             // Update the last packet time.
             last_packet_time = time(NULL);
 
@@ -134,16 +128,21 @@ void *worker_thread(void *arg) {
             // Increment the packet counter.
             current_packets++;
 
-            // Send the packet via UDP.
-            ssize_t sentBytes = sendto(udpSocket, buffer, strlen(buffer), 0, (struct sockaddr *)&destAddr, sizeof(destAddr));
-
-            // If cloning is enabled, send the packet to the cloned destination.
-            if (config.CLONE_ENABLED) {
-                sendto(udpSocket, buffer, strlen(buffer), 0, (struct sockaddr *)&cloneDestAddr, sizeof(cloneDestAddr));
+            // Send the packet via UDP, the socket is connected so the route is cached.
+            ssize_t sentBytes = send(udpSocket, packet->data, packet->len, 0);
+            if (sentBytes == -1 && (errno == ECONNREFUSED || errno == EAGAIN || errno == EWOULDBLOCK)) {
+                // ICMP unreachable replies to earlier packets surface here on a connected
+                // socket, this packet was not the cause, so try it once more before
+                // handing it to the requeue, like the fanout senders do.
+                destination_record_error(health, errno);
+                sentBytes = send(udpSocket, packet->data, packet->len, 0);
             }
+            // A send that hit OUTBOUND_UDP_TIMEOUT is not progress for the watchdog.
+            int timedOut = sentBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
 
             // Handle send errors.
             if (sentBytes == -1) {
+                destination_record_error(health, errno);
                 time_t current_time = time(NULL);
 
                 // Rate limiting and metric injection for packet drop errors.
@@ -161,16 +160,18 @@ void *worker_thread(void *arg) {
                         error_time = current_time;
                     }
                 }
-                if (isMetricValid(buffer)) {
-                    // Requeue the packet if the send failed.
-                    injectPacket(buffer);
+                if (isMetricValid(packet->data)) {
+                    // Requeue the packet if the send failed, the requeue takes its own reference.
+                    injectPacket(packet);
                 }
-                free(buffer); //decided to add this back
-                // it was removed before but I think it was false positives
-                // for this creating segment faults.
+                packet_release(packet);
             } else {
-                // Free the packet buffer if the send was successful.
-                free(buffer);
+                // Release the packet if the send was successful.
+                destination_record_sent(health, 1);
+                packet_release(packet);
+            }
+            if (!timedOut) {
+                watchdog_beat(args->workerID);
             }
         } else {
             // Exit the thread if there has been no packet for 5 seconds.
@@ -1,4 +1,5 @@
 // main.c
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,21 +13,39 @@
 #include "lib/config_reader.h"
 #include "lib/requeue.h"
 #include "lib/global.h"
+#include "lib/tags.h"
+#include "lib/fanout.h"
+#include "lib/cardinality.h"
+#include "lib/ingress.h"
+#include "lib/sources.h"
+#include "lib/sockstats.h"
+#include "lib/destination.h"
+#include "lib/watchdog.h"
+#include "lib/capture.h"
+#include "lib/priority.h"
+#include "lib/budget.h"
 #include "http.h"
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 char VERSION[] = "0.9.6.3";
 
+volatile sig_atomic_t drain_requested = 0;
+
 int packet_counter = 0;
 pthread_mutex_t packet_counter_mutex = PTHREAD_MUTEX_INITIALIZER;
 Queue **queues = NULL;
 
+#define RECV_BATCH_MAX 1024
+
 struct WorkerArgs {
     Queue *queue;
     int udpSocket;
     struct sockaddr_in destAddr;
     int workerID;
     int bufferSize;
+    DestinationHealth *health;
 };
 
 int create_thread_with_retry(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine) (void *), void *arg, int max_retries) {
@@ -44,21 +63,6 @@ int create_thread_with_retry(pthread_t *thread, const pthread_attr_t *attr, void
     return 0; // Failed to create the thread after max_retries
 }
 
-int initialize_shared_udp_socket(const char *ip, int port, struct sockaddr_in *address) {
-    int udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
-
-    if (udpSocket == -1) {
-        write_log("Shared Socket creation failed");
-        return -1;
-    }
-
-    address->sin_family = AF_INET;
-    address->sin_port = htons(port);
-    address->sin_addr.s_addr = inet_addr(ip);
-
-    return udpSocket;
-}
-
 int initialize_listener_udp_socket(const char *ip, int port, struct sockaddr_in *address) {
     int udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
     address->sin_family = AF_INET;
@@ -82,6 +86,140 @@ int initialize_listener_udp_socket(const char *ip, int port, struct sockaddr_in
     return udpSocket;
 }
 
+int initialize_listener_unix_socket(const char *path, int mode, int receiveBufferSize) {
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        write_log("Unix socket path too long: %s", path);
+        return -1;
+    }
+
+    int unixSocket = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (unixSocket == -1) {
+        write_log("Unix socket creation failed");
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);  // A previous run may have left the socket file behind
+
+    if (bind(unixSocket, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        write_log("Unix socket bind failed: %s", path);
+        perror("Unix socket bind failed");
+        close(unixSocket);
+        return -1;
+    }
+    if (chmod(path, mode) < 0) {
+        write_log("chmod %o failed on %s", mode, path);
+    }
+    socket_set_buffer(unixSocket, 1, receiveBufferSize, "unix listener");
+
+    return unixSocket;
+}
+
+void *unix_listener_thread(void *arg) {
+    int unixSocket = *(int *)arg;
+    set_thread_name("UnixListener");
+
+    int bufferSize = config.MAX_MESSAGE_SIZE + 1;
+    char *buffer = malloc(bufferSize);
+    if (buffer == NULL) {
+        write_log("Failed to allocate the unix socket receive buffer");
+        return NULL;
+    }
+    budget_charge(bufferSize);
+
+    while (!drain_requested) {
+        ssize_t recvLen = recv(unixSocket, buffer, config.MAX_MESSAGE_SIZE, 0);
+        if (recvLen > 0) {
+            ingress_submit(buffer, (int)recvLen, bufferSize, NULL);
+        }
+    }
+
+    budget_credit(bufferSize);
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Receives UDP datagrams in batches with recvmmsg until a drain is requested.
+ *
+ * Every slot of the batch has a fixed MAX_MESSAGE_SIZE buffer that is reused,
+ * ingress copies accepted lines into packets of their own size. The
+ * SO_RXQ_OVFL control message carries the kernel drop counter of the socket.
+ */
+void receive_udp(int udpSocket, int batchSize) {
+    // The per batch arrays live on the stack.
+    if (batchSize > RECV_BATCH_MAX) {
+        write_log("RECV_BATCH_SIZE %d is above the maximum, using %d", batchSize, RECV_BATCH_MAX);
+        batchSize = RECV_BATCH_MAX;
+    }
+    struct mmsghdr messages[batchSize];
+    struct iovec iovecs[batchSize];
+    struct sockaddr_in clientAddrs[batchSize];
+    // The union aligns each buffer for the struct cmsghdr that CMSG_FIRSTHDR returns.
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(uint32_t))];
+    } control[batchSize];
+    memset(messages, 0, sizeof(messages));
+
+    // One contiguous block of receive buffers, reused for every batch. Accepted
+    // lines are copied out by ingress_submit.
+    int bufferSize = config.MAX_MESSAGE_SIZE + 1;
+    char *buffers = malloc((size_t)batchSize * bufferSize);
+    if (buffers == NULL) {
+        write_log("Failed to allocate %d receive buffers", batchSize);
+        return;
+    }
+    budget_charge((long)batchSize * bufferSize);
+    for (int i = 0; i < batchSize; ++i) {
+        iovecs[i].iov_base = buffers + (size_t)i * bufferSize;
+        iovecs[i].iov_len = config.MAX_MESSAGE_SIZE;
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &clientAddrs[i];
+        messages[i].msg_hdr.msg_control = control[i].buffer;
+    }
+
+    while (!drain_requested) {
+        // The kernel shortens these to what it wrote, reset them for every batch.
+        for (int i = 0; i < batchSize; ++i) {
+            messages[i].msg_hdr.msg_namelen = sizeof(clientAddrs[i]);
+            messages[i].msg_hdr.msg_controllen = sizeof(control[i].buffer);
+        }
+
+        int received = recvmmsg(udpSocket, messages, batchSize, MSG_WAITFORONE, NULL);
+        if (received <= 0) {
+            continue;
+        }
+
+        uint32_t overflow = 0;
+        int sawOverflow = 0;
+        for (int i = 0; i < received; ++i) {
+            struct cmsghdr *cmsg;
+            for (cmsg = CMSG_FIRSTHDR(&messages[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&messages[i].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                    memcpy(&overflow, CMSG_DATA(cmsg), sizeof(overflow));
+                    sawOverflow = 1;
+                }
+            }
+
+            int recvLen = (int)messages[i].msg_len;
+            if (recvLen > 0) {
+                ingress_submit(iovecs[i].iov_base, recvLen, bufferSize, &clientAddrs[i]);
+            }
+        }
+        if (sawOverflow) {
+            sockstats_record_overflow(overflow);
+        }
+    }
+
+    budget_credit((long)batchSize * bufferSize);
+    free(buffers);
+}
+
 struct MonitorArgs {
     pthread_t *threads;
     struct WorkerArgs *args;
@@ -96,7 +234,13 @@ void *monitor_worker_threads(void *arg) {
     struct WorkerArgs *args = monitorArgs->args;
     int num_threads = monitorArgs->num_threads;
 
-    while (1) {
+    for (int tick = 0; ; ++tick) {
+        // Stalls are checked every second, thread liveness every 5 seconds.
+        watchdog_check(queues, num_threads);
+        if (tick % 5 != 0) {
+            sleep(1);
+            continue;
+        }
         for (int i = 0; i < num_threads; ++i) {
             int ret = pthread_kill(threads[i], 0);  // Check the thread status
             if (ret != 0) {
@@ -108,66 +252,126 @@ void *monitor_worker_threads(void *arg) {
                 pthread_create(&threads[i], NULL, worker_thread, &args[i]);
             }
         }
-        sleep(5);  // Wait for 5 seconds before checking again
+        if (!drain_requested) {
+            destination_inject_metrics();
+            priority_inject_metrics();
+            budget_inject_metrics();
+        }
+        sleep(1);
     }
 
     return NULL;
 }
 
 
+void handle_shutdown_signal(int signum) {
+    drain_requested = 1;
+}
+
+/**
+ * Waits for every queued, requeued and in flight packet to be sent or for the
+ * deadline to pass, whichever comes first, then reports the outcome.
+ *
+ * Workers keep running while this waits, so packets that fail to send are
+ * requeued and retried until the deadline.
+ *
+ * @param timeoutSeconds How long to wait for the queues to empty.
+ * @return The number of packets still pending when the drain ended.
+ */
+long drain_pending_packets(int timeoutSeconds) {
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    requeue_set_draining(1);
+
+    long pendingAtStart = packet_live_count();
+    write_log("Draining %ld pending packets, deadline %d seconds", pendingAtStart, timeoutSeconds);
+
+    long pending = pendingAtStart;
+    while (pending > 0) {
+        gettimeofday(&now, NULL);
+        if (now.tv_sec - start.tv_sec >= timeoutSeconds) {
+            break;
+        }
+        usleep(10000);
+        pending = packet_live_count();
+    }
+
+    gettimeofday(&now, NULL);
+    long elapsedMs = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+    long flushed = pendingAtStart > pending ? pendingAtStart - pending : 0;
+    write_log("Drain finished in %ld ms: %ld packets flushed, %ld lost", elapsedMs, flushed, pending);
+    return pending;
+}
+
 int main() {
     if (read_config("conf/config.conf") == -1) {
         write_log("Failed to read configuration");
         return 1;
     }
+
+    // Only the receive loop handles SIGTERM/SIGINT, every thread started below inherits this mask.
+    sigset_t shutdownSignals;
+    sigemptyset(&shutdownSignals);
+    sigaddset(&shutdownSignals, SIGTERM);
+    sigaddset(&shutdownSignals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &shutdownSignals, NULL);
     
     write_log("Starting CStatsDProxy server: Version %s\n", VERSION);
 
     if (config.LOGGING_ENABLED) {
         write_log("Starting server on %s:%d", config.LISTEN_UDP_IP, config.UDP_PORT);
         write_log("Forwarding to %s:%d", config.DEST_UDP_IP, config.DEST_UDP_PORT);
-        if (config.CLONE_ENABLED) {
-            write_log("Cloning to %s:%d", config.CLONE_DEST_UDP_IP, config.CLONE_DEST_UDP_PORT);
-        }
     }
 
     HttpConfig conf;
     conf.port = config.HTTP_PORT;
     strncpy(conf.ip_address, config.HTTP_LISTEN_IP, sizeof(conf.ip_address));
     pthread_t http_thread;
-    if (pthread_create(&http_thread, NULL, http_server, (void *)&config) < 0) {
+    if (pthread_create(&http_thread, NULL, http_server, (void *)&conf) < 0) {
         write_log("could not create http server thread");
         return 1;
     }
 
-    struct sockaddr_in destAddr, serverAddr;
-    int sharedUdpSocket = initialize_shared_udp_socket(config.DEST_UDP_IP, config.DEST_UDP_PORT, &destAddr);
+    struct sockaddr_in serverAddr;
     int udpSocket = initialize_listener_udp_socket(config.LISTEN_UDP_IP, config.UDP_PORT, &serverAddr);
-    if (sharedUdpSocket == -1 || udpSocket == -1) {
+    if (udpSocket == -1) {
         write_log("Failed to initialize sockets");
         return 1;
     } else {
         write_log("Sockets initialized");
     }
 
-    struct timeval timeout;
-    timeout.tv_sec = config.OUTBOUND_UDP_TIMEOUT;  // Use the defined constant
-    timeout.tv_usec = 0;
-    if (setsockopt(sharedUdpSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
-        write_log("setsockopt failed");
-    }
+    socket_set_buffer(udpSocket, 1, config.LISTEN_RCVBUF, "UDP listener");
+    sockstats_enable_overflow(udpSocket);
+    sockstats_watch_udp(udpSocket, "listener");
 
+    // Each worker gets its own socket connected to the destination.
+    DestinationHealth *destHealth = destination_register(config.DEST_UDP_IP, config.DEST_UDP_PORT);
     pthread_t threads[config.MAX_THREADS];
     struct WorkerArgs args[config.MAX_THREADS];
-    queues = malloc(sizeof(Queue*) * config.MAX_QUEUE_SIZE);
+    queues = malloc(sizeof(Queue*) * config.MAX_THREADS);
+    budget_init();
+    if (priority_init() != 0) {
+        write_log("Failed to initialize priority classes");
+        return 1;
+    }
+    if (watchdog_init(config.MAX_THREADS) != 0) {
+        write_log("Failed to initialize worker watchdog");
+        return 1;
+    }
     write_log("Starting %d worker threads", config.MAX_THREADS);
     for (int i = 0; i < config.MAX_THREADS; ++i) {
         queues[i] = initQueue(config.MAX_QUEUE_SIZE);
+        priority_configure_queue(queues[i]);
         args[i].queue = queues[i];
-        args[i].udpSocket = sharedUdpSocket;
-        args[i].destAddr = destAddr;
+        args[i].udpSocket = destination_connect_udp(config.DEST_UDP_IP, config.DEST_UDP_PORT, &args[i].destAddr);
+        if (args[i].udpSocket == -1) {
+            write_log("Failed to initialize outbound socket for worker %d", i);
+            return 1;
+        }
         args[i].workerID = i;
         args[i].bufferSize = config.BUFFER_SIZE;
+        args[i].health = destHealth;
         if (!create_thread_with_retry(&threads[i], NULL, worker_thread, &args[i], 10)) {
             fprintf(stderr, "Failed to create thread after multiple attempts. Exiting.\n");
             exit(EXIT_FAILURE);
@@ -183,45 +387,98 @@ int main() {
         return 1;
     }
 
+    tags_init();
+
+    if (fanout_init() != 0) {
+        write_log("Failed to initialize fanout destinations");
+        return 1;
+    }
+
+    if (config.CARDINALITY_ENABLED && cardinality_init() != 0) {
+        write_log("Failed to initialize cardinality limiter");
+        return 1;
+    }
+
+    if (sockstats_init() != 0) {
+        write_log("Failed to initialize socket stats");
+        return 1;
+    }
+
+    if (config.SOURCE_TRACKING_ENABLED && sources_init() != 0) {
+        write_log("Failed to initialize source tracking");
+        return 1;
+    }
+
+    if (config.CAPTURE_ENABLED && capture_init() != 0) {
+        write_log("Failed to initialize traffic capture");
+        return 1;
+    }
+
     if (config.LOGGING_ENABLED) {
         write_log("Logging enabled");
     }
-    
-    int RoundRobinCounter = 0;
-    while (1) {
-        char *buffer = malloc(config.MAX_MESSAGE_SIZE + 1);
-        struct sockaddr_in clientAddr;
-        socklen_t addrSize = sizeof(clientAddr);
-        ssize_t recvLen = recvfrom(udpSocket, buffer, config.MAX_MESSAGE_SIZE, 0, (struct sockaddr *)&clientAddr, &addrSize);
 
-        if (recvLen > 0) {
-            buffer[recvLen] = '\0';
-            if (isMetricValid(buffer)) {
-                enqueue(queues[RoundRobinCounter], buffer);
-                RoundRobinCounter = (RoundRobinCounter + 1) % config.MAX_THREADS;
-            } else {
-                injectMetric("invalid_packets", 1);
-                free(buffer); 
-            }
-        } else if (recvLen == 0) {
-            free(buffer); 
-        } else {
-            free(buffer); 
+    int unixSocket = -1;
+    pthread_t unixThread;
+    if (config.UNIX_SOCKET_ENABLED) {
+        // A missing or unparsable UNIX_SOCKET_MODE must not leave a socket nobody can write to.
+        int unixMode = config.UNIX_SOCKET_MODE > 0 && config.UNIX_SOCKET_MODE <= 07777 ? config.UNIX_SOCKET_MODE : 0660;
+        unixSocket = initialize_listener_unix_socket(config.UNIX_SOCKET_PATH, unixMode,
+                                                     config.UNIX_SOCKET_RCVBUF > 0 ? config.UNIX_SOCKET_RCVBUF : 8388608);
+        if (unixSocket == -1) {
+            write_log("Failed to initialize unix socket listener");
+            return 1;
+        }
+        struct timeval unixReceiveTimeout = { 1, 0 };  // Lets the listener notice a drain
+        setsockopt(unixSocket, SOL_SOCKET, SO_RCVTIMEO, &unixReceiveTimeout, sizeof(unixReceiveTimeout));
+        if (pthread_create(&unixThread, NULL, unix_listener_thread, &unixSocket) != 0) {
+            write_log("Could not create unix socket listener thread");
+            return 1;
         }
+        write_log("Listening on unix socket %s, mode %04o", config.UNIX_SOCKET_PATH, unixMode);
     }
 
+    // No SA_RESTART, so a signal interrupts recvmmsg. The receive timeout covers a
+    // signal that lands between the loop check and the call.
+    struct sigaction shutdownAction;
+    memset(&shutdownAction, 0, sizeof(shutdownAction));
+    shutdownAction.sa_handler = handle_shutdown_signal;
+    sigemptyset(&shutdownAction.sa_mask);
+    sigaction(SIGTERM, &shutdownAction, NULL);
+    sigaction(SIGINT, &shutdownAction, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &shutdownSignals, NULL);
 
+    struct timeval receiveTimeout;
+    receiveTimeout.tv_sec = 1;
+    receiveTimeout.tv_usec = 0;
+    if (setsockopt(udpSocket, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout)) < 0) {
+        write_log("setsockopt failed");
+    }
+
+    receive_udp(udpSocket, config.RECV_BATCH_SIZE > 0 ? config.RECV_BATCH_SIZE : 32);
+
+    // Stop reading so nothing new arrives, then give the workers until the deadline to flush.
+    stop_metric_injection();
+    write_log("Shutdown requested, no longer accepting packets");
+    close(udpSocket);
+    if (unixSocket != -1) {
+        pthread_join(unixThread, NULL);
+        close(unixSocket);
+        unlink(config.UNIX_SOCKET_PATH);
+    }
+    capture_close();
+    drain_pending_packets(config.DRAIN_TIMEOUT > 0 ? config.DRAIN_TIMEOUT : 10);
+
+    // The supervisor goes first so it does not restart the workers we cancel.
+    pthread_cancel(monitor_thread);
+    pthread_join(monitor_thread, NULL);
     for (int i = 0; i < config.MAX_THREADS; ++i) {
         pthread_cancel(threads[i]);
         pthread_join(threads[i], NULL);
+        close(args[i].udpSocket);
     }
-    pthread_cancel(monitor_thread);
-    if (config.HTTP_ENABLED) {
-        pthread_join(http_thread, NULL);
-    }
-    pthread_join(monitor_thread, NULL);
-    close(sharedUdpSocket);
-    close(udpSocket);
+    pthread_cancel(http_thread);
+    pthread_join(http_thread, NULL);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,228 @@
+/**
+ * @file replay.c
+ * @brief Streams a capture file back into a proxy, see lib/capture.c.
+ *
+ * Built with `make replay`. Records are sent in their captured order and
+ * spacing divided by the speed factor, or as fast as sendmmsg allows with
+ * `-s max`. Ready records are sent in batches, so a high speed factor does
+ * not cost one syscall per datagram.
+ *
+ * Usage: bin/CStatsDReplay [-h host] [-p port] [-u unix_path] [-s speed|max] [-l loops] capture_file
+ *
+ * Prints one JSON object with the totals when done.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include "capture.h"
+
+#define REPLAY_BATCH 64
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadlineNs) {
+    struct timespec deadline = { deadlineNs / 1000000000ull, deadlineNs % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-u unix_path] [-s speed|max] [-l loops] capture_file\n"
+                    "  -h  destination address (default 127.0.0.1)\n"
+                    "  -p  destination port (default 8125)\n"
+                    "  -u  send to a unix datagram socket instead of UDP\n"
+                    "  -s  speed factor, 1 replays in real time, max sends without pacing (default 1)\n"
+                    "  -l  number of passes over the file (default 1)\n", program);
+}
+
+static int connect_destination(const char *host, int port, const char *unixPath) {
+    int sock;
+    if (unixPath != NULL) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, unixPath, sizeof(address.sun_path) - 1);
+        sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (sock >= 0 && connect(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+            perror("connect");
+            close(sock);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        if (inet_pton(AF_INET, host, &address.sin_addr) != 1) {
+            fprintf(stderr, "Invalid address: %s\n", host);
+            return -1;
+        }
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock >= 0 && connect(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+            perror("connect");
+            close(sock);
+            return -1;
+        }
+    }
+    if (sock < 0) {
+        perror("socket");
+    }
+    return sock;
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    const char *unixPath = NULL;
+    int port = 8125;
+    double speed = 1.0;
+    long loops = 1;
+    int option;
+
+    while ((option = getopt(argc, argv, "h:p:u:s:l:")) != -1) {
+        switch (option) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'u': unixPath = optarg; break;
+            case 's':
+                if (strcmp(optarg, "max") == 0) {
+                    speed = 0;
+                } else {
+                    char *parsedEnd;
+                    speed = strtod(optarg, &parsedEnd);
+                    if (parsedEnd == optarg || *parsedEnd != '\0' || !(speed > 0)) {
+                        fprintf(stderr, "Invalid speed: %s, expected a positive number or max\n", optarg);
+                        return 1;
+                    }
+                }
+                break;
+            case 'l': loops = atol(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 1 || speed < 0 || loops < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    int fd = open(path, O_RDONLY);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) < 0) {
+        perror(path);
+        return 1;
+    }
+    if ((size_t)fileStat.st_size < sizeof(CaptureHeader)) {
+        fprintf(stderr, "%s: too small to be a capture file\n", path);
+        return 1;
+    }
+    const char *map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    const CaptureHeader *header = (const CaptureHeader *)map;
+    if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 || header->version != CAPTURE_VERSION) {
+        fprintf(stderr, "%s: not a version %d capture file\n", path, CAPTURE_VERSION);
+        return 1;
+    }
+    if (header->headerSize < sizeof(CaptureHeader) || header->headerSize > (uint64_t)fileStat.st_size) {
+        fprintf(stderr, "%s: corrupt capture header, header size %u\n", path, header->headerSize);
+        return 1;
+    }
+    // A file still being captured is replayed up to the last complete record.
+    uint64_t used = __atomic_load_n(&header->used, __ATOMIC_ACQUIRE);
+    if (used > (uint64_t)fileStat.st_size - header->headerSize) {
+        used = fileStat.st_size - header->headerSize;
+    }
+    const char *records = map + header->headerSize;
+    const char *end = records + used;
+
+    int sock = connect_destination(host, port, unixPath);
+    if (sock < 0) {
+        return 1;
+    }
+
+    struct mmsghdr messages[REPLAY_BATCH];
+    struct iovec iovecs[REPLAY_BATCH];
+    memset(messages, 0, sizeof(messages));
+    for (int i = 0; i < REPLAY_BATCH; ++i) {
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    unsigned long sent = 0;
+    unsigned long bytes = 0;
+    unsigned long errors = 0;
+    uint64_t start = monotonic_ns();
+    uint64_t recordedNs = 0;  // Position in the capture's own timeline
+
+    for (long loop = 0; loop < loops; ++loop) {
+        const char *cursor = records;
+        while (cursor < end) {
+            // Gather the records that are due, waiting for the first one if needed.
+            int count = 0;
+            while (cursor + sizeof(CaptureRecord) <= end && count < REPLAY_BATCH) {
+                CaptureRecord record;
+                memcpy(&record, cursor, sizeof(record));
+                if (cursor + sizeof(record) + record.len > end) {
+                    cursor = end;
+                    break;
+                }
+                // The first record of a pass goes out at once, its delta is the wait
+                // between proxy start and the first datagram.
+                if (speed > 0 && cursor != records) {
+                    uint64_t due = start + (uint64_t)((recordedNs + record.deltaMicros * 1000ull) / speed);
+                    if (due > monotonic_ns()) {
+                        if (count > 0) {
+                            break;
+                        }
+                        sleep_until(due);
+                    }
+                    recordedNs += record.deltaMicros * 1000ull;
+                }
+                iovecs[count].iov_base = (void *)(cursor + sizeof(record));
+                iovecs[count].iov_len = record.len;
+                bytes += record.len;
+                count++;
+                cursor += sizeof(record) + record.len;
+            }
+
+            int done = 0;
+            while (done < count) {
+                int result = sendmmsg(sock, messages + done, count - done, 0);
+                if (result > 0) {
+                    done += result;
+                    sent += result;
+                } else {
+                    errors++;
+                    done++;  // Skip the datagram that failed
+                }
+            }
+        }
+    }
+
+    double elapsed = (monotonic_ns() - start) / 1e9;
+    printf("{\"file\":\"%s\",\"records\":%llu,\"loops\":%ld,\"sent\":%lu,\"bytes\":%lu,\"errors\":%lu,"
+           "\"seconds\":%.3f,\"packets_per_sec\":%.0f}\n",
+           path, (unsigned long long)header->records, loops, sent, bytes, errors,
+           elapsed, elapsed > 0 ? sent / elapsed : 0);
+
+    close(sock);
+    munmap((void *)map, fileStat.st_size);
+    close(fd);
+    return 0;
+}